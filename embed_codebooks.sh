@@ -0,0 +1,29 @@
+#!/bin/sh
+# write a C file building the given packed codebook libraries into the
+# program, to be found by file name (see embedded_codebooks.h)
+OUT=${1:?}
+shift
+
+{
+  echo "/* generated by embed_codebooks.sh from $*, do not edit */"
+  echo "#include \"embedded_codebooks.h\""
+  echo
+
+  n=0
+  for f in "$@"; do
+    echo "static const unsigned char data$n[] = {"
+    od -An -v -tu1 "$f" | sed -e 's/^ *//' -e 's/  */,/g' -e 's/$/,/'
+    echo "};"
+    echo
+    n=$((n+1))
+  done
+
+  echo "const struct embedded_file embedded_codebooks[] = {"
+  n=0
+  for f in "$@"; do
+    echo "  {\"$(basename "$f")\", data$n, sizeof(data$n)},"
+    n=$((n+1))
+  done
+  echo "  {0, 0, 0}"
+  echo "};"
+} > "$OUT.tmp" && mv "$OUT.tmp" "$OUT"
@@ -2,16 +2,40 @@ ZIPNAME=${1:?}
 
 zip "ww2ogg$ZIPNAME.zip" \
   src/Bit_stream.h \
+  src/bench.cpp \
+  src/check.cpp \
   src/codebook.cpp \
   src/codebook.h \
+  src/compile_codebooks.cpp \
   src/crc.c \
   src/crc.h \
+  src/difftest.cpp \
+  src/embedded_codebooks.h \
   src/errors.h \
+  src/funnel.c \
+  src/funnel.h \
+  src/hash.h \
+  src/input_buffer.cpp \
+  src/input_buffer.h \
+  src/libww2ogg.cpp \
+  src/libww2ogg.h \
+  src/microbench.cpp \
+  src/perf_counters.cpp \
+  src/perf_counters.h \
+  src/setup_cache.cpp \
+  src/setup_cache.h \
+  src/stats.cpp \
+  src/stats.h \
+  src/synthetic_wem.cpp \
+  src/synthetic_wem.h \
+  src/work_stealing.cpp \
+  src/work_stealing.h \
   src/ww2ogg.cpp \
   src/wwriff.cpp \
   src/wwriff.h \
   CHANGELOG \
   COPYING \
+  embed_codebooks.sh \
   Makefile \
   Makefile.common \
   Makefile.mingw \
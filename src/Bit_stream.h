@@ -5,15 +5,23 @@
 #define __STDC_CONSTANT_MACROS
 #endif
 #include <iostream>
+#include <vector>
 #include <limits>
+#include <cstring>
 #include <stdint.h>
 
 #include "errors.h"
 #include "crc.h"
+#include "funnel.h"
+#include "stats.h"
+
+// Built with WW2OGG_REFERENCE, the bit streams below move one bit at a
+// time as ww2ogg first did, with no word-wide or bulk copies, for
+// ww2ogg_reference to check the fast paths against (see difftest.cpp).
 
 // host-endian-neutral integer reading
 namespace {
-    uint32_t read_32_le(unsigned char b[4])
+    uint32_t read_32_le(const unsigned char b[4])
     {
         uint32_t v = 0;
         for (int i = 3; i >= 0; i--)
@@ -51,7 +59,7 @@ namespace {
         os.write(b, 4);
     }
 
-    uint16_t read_16_le(unsigned char b[2])
+    uint16_t read_16_le(const unsigned char b[2])
     {
         uint16_t v = 0;
         for (int i = 1; i >= 0; i--)
@@ -89,7 +97,7 @@ namespace {
         os.write(b, 2);
     }
 
-    uint32_t read_32_be(unsigned char b[4])
+    uint32_t read_32_be(const unsigned char b[4])
     {
         uint32_t v = 0;
         for (int i = 0; i < 4; i++)
@@ -127,7 +135,7 @@ namespace {
         os.write(b, 4);
     }
 
-    uint16_t read_16_be(unsigned char b[2])
+    uint16_t read_16_be(const unsigned char b[2])
     {
         uint16_t v = 0;
         for (int i = 0; i < 2; i++)
@@ -167,34 +175,91 @@ namespace {
 
 }
 
-// using an istream, pull off individual bits with get_bit (LSB first)
+// pull bits (LSB first) out of a contiguous buffer, refilling a 64-bit
+// word at a time
 class Bit_stream {
-    std::istream& is;
+    const unsigned char * pos;
+    const unsigned char * end;
 
-    unsigned char bit_buffer;
+    uint64_t bit_buffer;
     unsigned int bits_left;
     unsigned long total_bits_read;
 
+    // Intentionally undefined
+    Bit_stream& operator=(const Bit_stream& rhs);
+    Bit_stream(const Bit_stream& rhs);
+
+    // top up bit_buffer to at least 56 bits if that much input remains;
+    // bits above bits_left may hold a copy of the next byte, which is
+    // harmless as the same bits are ORed back in on the next refill
+    void refill(void) {
+        if (end - pos >= 8) {
+            uint64_t w = 0;
+            for (int i = 7; i >= 0; i--) {
+                w <<= 8;
+                w |= pos[i];
+            }
+            bit_buffer |= w << bits_left;
+
+            unsigned int bytes = (63 - bits_left) >> 3;
+            pos += bytes;
+            bits_left += bytes << 3;
+        } else {
+            while (bits_left <= 56 && pos != end) {
+                bit_buffer |= static_cast<uint64_t>(*pos++) << bits_left;
+                bits_left += 8;
+            }
+        }
+    }
+
 public:
     class Weird_char_size {};
-    class Out_of_bits {};
+    class Out_of_bits : public Parse_error {
+    public:
+        virtual void print_self(ostream& os) const {
+            os << "ran out of bits";
+        }
+    };
 
-    Bit_stream(std::istream& _is) : is(_is), bit_buffer(0), bits_left(0), total_bits_read(0) {
+    Bit_stream(const unsigned char * data, unsigned long size) :
+        pos(data), end(data + size), bit_buffer(0), bits_left(0), total_bits_read(0) {
         if ( std::numeric_limits<unsigned char>::digits != 8)
             throw Weird_char_size();
     }
-    bool get_bit() {
-        if (bits_left == 0) {
-
-            int c = is.get();
-            if (c == EOF) throw Out_of_bits();
-            bit_buffer = c;
-            bits_left = 8;
 
+    // n <= 32
+#ifdef WW2OGG_REFERENCE
+    unsigned int get_bits(unsigned int n) {
+        unsigned int v = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            if (bits_left == 0) {
+                if (pos == end) throw Out_of_bits();
+                bit_buffer = *pos++;
+                bits_left = 8;
+            }
+            bits_left --;
+            if (bit_buffer & (0x80 >> bits_left)) v |= 1U << i;
+            total_bits_read++;
         }
-        total_bits_read++;
-        bits_left --;
-        return ( ( bit_buffer & ( 0x80 >> bits_left ) ) != 0);
+        return v;
+    }
+#else
+    unsigned int get_bits(unsigned int n) {
+        if (bits_left < n) {
+            refill();
+            if (bits_left < n) throw Out_of_bits();
+        }
+
+        unsigned int v = static_cast<unsigned int>(bit_buffer & ((static_cast<uint64_t>(1) << n) - 1));
+        bit_buffer >>= n;
+        bits_left -= n;
+        total_bits_read += n;
+        return v;
+    }
+#endif
+
+    bool get_bit() {
+        return get_bits(1) != 0;
     }
 
     unsigned long get_total_bits_read(void) const
@@ -203,118 +268,310 @@ public:
     }
 };
 
+// collect bits (LSB first) in a 64-bit accumulator, spilling 32-bit words
+// into Ogg page payloads; each packet gets a page of its own, unless given
+// a page size, then packets are packed into pages of about that size
 class Bit_oggstream {
     std::ostream& os;
 
-    unsigned char bit_buffer;
+    uint64_t bit_buffer;
     unsigned int bits_stored;
 
     enum {header_bytes = 27, max_segments = 255, segment_size = 255};
+    enum {max_packet_bytes = segment_size * max_segments};
 
     unsigned int payload_bytes;
     bool first, continued;
-    unsigned char page_buffer[header_bytes + max_segments + segment_size * max_segments];
+    // header, lacing and payload, on the heap as it's too big for a
+    // thread's stack; a packed page can hold up to a page of finished
+    // packets ahead of the current one, so it gets room for two packets
+    std::vector<unsigned char> page_buffer;
     uint32_t granule;
     uint32_t seqno;
 
+    // packed pages
+    unsigned int page_size;             // 0 for a page per packet
+    unsigned int packet_start;          // of the current packet in the payload
+    unsigned int segments;              // lacing values for finished packets
+    unsigned char lacing[max_segments];
+    bool packet_ended;                  // on this page, so page_granule is set
+    uint32_t page_granule;
+
+    Conversion_stats * stats;           // may be NULL
+
+    // Intentionally undefined
+    Bit_oggstream& operator=(const Bit_oggstream& rhs);
+    Bit_oggstream(const Bit_oggstream& rhs);
+
+    unsigned int packet_limit(void) const {
+        return packet_start + max_packet_bytes;
+    }
+
+    // move the low byte of bit_buffer (possibly partial) into the payload
+    void put_byte(void) {
+        if (payload_bytes == packet_limit())
+        {
+            throw Parse_error_str("ran out of space in an Ogg packet");
+        }
+
+        page_buffer[header_bytes + max_segments + payload_bytes] = static_cast<unsigned char>(bit_buffer);
+        payload_bytes ++;
+
+        bit_buffer >>= 8;
+        bits_stored = (bits_stored > 8) ? bits_stored - 8 : 0;
+    }
+
+    // put out the page made of the first bytes of the payload, its lacing
+    // values already in place just ahead of it
+    void write_page(unsigned int bytes, unsigned int page_segments, uint32_t g, bool last) {
+        // the header and lacing go right before the payload, which
+        // sits after room for the most lacing values we could need
+        unsigned char * page = &page_buffer[max_segments - page_segments];
+        unsigned int page_bytes = header_bytes + page_segments + bytes;
+
+        page[0] = 'O';
+        page[1] = 'g';
+        page[2] = 'g';
+        page[3] = 'S';
+        page[4] = 0; // stream_structure_version
+        page[5] = (continued?1:0) | (first?2:0) | (last?4:0); // header_type_flag
+        write_32_le(&page[6], g);        // granule low bits
+        write_32_le(&page[10], 0);       // granule high bits
+        if (g == UINT32_C(0xFFFFFFFF))
+            write_32_le(&page[10], UINT32_C(0xFFFFFFFF));
+        write_32_le(&page[14], 1);       // stream serial number
+        write_32_le(&page[18], seqno);   // page sequence number
+        write_32_le(&page[22], 0);       // checksum (0 for now)
+        page[26] = page_segments;        // segment count
+
+        // checksum
+        {
+            Stats_stage stage(stats, Conversion_stats::checksum);
+            write_32_le(&page[22], checksum(page, page_bytes));
+        }
+
+        // output to ostream, the whole page in one go
+        {
+            Stats_stage stage(stats, Conversion_stats::output);
+            os.write(reinterpret_cast<char *>(page), page_bytes);
+        }
+
+        stats_add(stats, Conversion_stats::pages, 1);
+        stats_add(stats, Conversion_stats::bytes_out, page_bytes);
+
+        seqno++;
+        first = false;
+    }
+
+    // put out the finished packets and the first bytes of the current
+    // one, which leaves the rest of it at the start of the payload
+    void write_packed_page(unsigned int bytes, bool last) {
+        memcpy(&page_buffer[header_bytes + max_segments - segments], lacing, segments);
+        write_page(bytes, segments, packet_ended ? page_granule : UINT32_C(0xFFFFFFFF), last);
+
+        unsigned char * payload = &page_buffer[header_bytes + max_segments];
+        memmove(payload, payload + bytes, payload_bytes - bytes);
+        payload_bytes -= bytes;
+        packet_start = 0;
+        segments = 0;
+        packet_ended = false;
+    }
+
 public:
     class Weird_char_size {};
 
-    Bit_oggstream(std::ostream& _os) :
-        os(_os), bit_buffer(0), bits_stored(0), payload_bytes(0), first(true), continued(false), granule(0), seqno(0) {
+    // page_size 0 for a page per packet, otherwise at most a full packet
+    explicit Bit_oggstream(std::ostream& _os, unsigned int _page_size = 0, Conversion_stats * _stats = NULL) :
+        os(_os), bit_buffer(0), bits_stored(0), payload_bytes(0), first(true), continued(false),
+        page_buffer(header_bytes + max_segments + (_page_size ? 2 : 1) * max_packet_bytes), granule(0), seqno(0),
+        page_size(_page_size < max_packet_bytes ? _page_size : static_cast<unsigned int>(max_packet_bytes)),
+        packet_start(0), segments(0), packet_ended(false), page_granule(0), stats(_stats) {
         if ( std::numeric_limits<unsigned char>::digits != 8)
             throw Weird_char_size();
         }
 
+    // n <= 32
+#ifdef WW2OGG_REFERENCE
+    void put_bits(uint32_t v, unsigned int n) {
+        for (unsigned int i = 0; i < n; i++) {
+            if (v & (1U << i)) bit_buffer |= 1U << bits_stored;
+            bits_stored ++;
+            if (bits_stored == 8) put_byte();
+        }
+    }
+#else
+    void put_bits(uint32_t v, unsigned int n) {
+        bit_buffer |= (static_cast<uint64_t>(v) & ((static_cast<uint64_t>(1) << n) - 1)) << bits_stored;
+        bits_stored += n;
+
+        if (bits_stored >= 32 && payload_bytes + 4 <= packet_limit())
+        {
+            write_32_le(&page_buffer[header_bytes + max_segments + payload_bytes],
+                    static_cast<uint32_t>(bit_buffer));
+            payload_bytes += 4;
+
+            bit_buffer >>= 32;
+            bits_stored -= 32;
+        }
+
+        // near the end of the payload go byte by byte, so running out of
+        // space is caught at the same point as ever, and there is always
+        // room to flush what is left
+        if (payload_bytes + 4 > packet_limit())
+        {
+            while (bits_stored >= 8)
+            {
+                put_byte();
+            }
+        }
+    }
+#endif
+
     void put_bit(bool bit) {
-        if (bit)
-        bit_buffer |= 1<<bits_stored;
+        put_bits(bit ? 1 : 0, 1);
+    }
 
-        bits_stored ++;
-        if (bits_stored == 8) {
-            flush_bits();
+    // copy whole bytes straight into the payload, shifting them into
+    // place if the output isn't byte-aligned
+#ifdef WW2OGG_REFERENCE
+    void put_bytes(const unsigned char * data, unsigned long n) {
+        for (unsigned long i = 0; i < n; i++) {
+            put_bits(data[i], 8);
         }
     }
+#else
+    void put_bytes(const unsigned char * data, unsigned long n) {
+        // leave only a partial byte in the accumulator
+        while (bits_stored >= 8)
+        {
+            put_byte();
+        }
+
+        unsigned long room = packet_limit() - payload_bytes;
+        unsigned long count = (n < room) ? n : room;
+        unsigned char * dst = &page_buffer[header_bytes + max_segments + payload_bytes];
+
+        if (bits_stored == 0)
+        {
+            memcpy(dst, data, count);
+        }
+        else
+        {
+            bit_buffer = funnel_shift_copy(dst, data, count, bits_stored,
+                    static_cast<unsigned char>(bit_buffer));
+        }
+        payload_bytes += count;
+
+        if (count != n)
+        {
+            throw Parse_error_str("ran out of space in an Ogg packet");
+        }
+    }
+#endif
 
     void set_granule(uint32_t g) {
         granule = g;
     }
 
+    // sequence number of the next page
+    uint32_t get_seqno(void) const {
+        return seqno;
+    }
+
+    // carry on a stream that's partly been written elsewhere
+    void continue_stream(uint32_t next_seqno) {
+        seqno = next_seqno;
+        first = false;
+    }
+
     void flush_bits(void) {
-        if (bits_stored != 0) {
-            if (payload_bytes == segment_size * max_segments)
-            {
-                throw Parse_error_str("ran out of space in an Ogg packet");
-                flush_page(true);
-            }
+        while (bits_stored != 0) {
+            put_byte();
+        }
+    }
+
+    // finish an audio packet: the end of its page, or of its part of a
+    // packed page, which goes out once full enough or last
+    void end_packet(bool last=false) {
+        if (!page_size)
+        {
+            flush_page(false, last);
+            return;
+        }
 
-            page_buffer[header_bytes + max_segments + payload_bytes] = bit_buffer;
-            payload_bytes ++;
+        stats_add(stats, Conversion_stats::bits_written, (payload_bytes - packet_start) * 8 + bits_stored);
 
-            bits_stored = 0;
-            bit_buffer = 0;
+        if (payload_bytes != packet_limit())
+        {
+            flush_bits();
+        }
+
+        // whatever won't fit in this page's lacing carries on in the next
+        unsigned int left = payload_bytes - packet_start;
+        while (segments + left / segment_size + 1 > max_segments)
+        {
+            unsigned int full = max_segments - segments;
+            memset(&lacing[segments], segment_size, full);
+            segments = max_segments;
+            left -= full * segment_size;
+
+            write_packed_page(packet_start + full * segment_size, false);
+            continued = true;
+        }
+
+        memset(&lacing[segments], segment_size, left / segment_size);
+        segments += left / segment_size;
+        lacing[segments++] = left % segment_size;
+
+        packet_ended = true;
+        page_granule = granule;
+        packet_start = payload_bytes;
+
+        if (last || payload_bytes >= page_size || segments == max_segments)
+        {
+            write_packed_page(payload_bytes, last);
+            continued = false;
         }
     }
 
+    // put out what there is as a page of its own, after any packed
+    // packets still waiting
     void flush_page(bool next_continued=false, bool last=false) {
-        if (payload_bytes != segment_size * max_segments)
+        if (segments != 0)
+        {
+            write_packed_page(packet_start, false);
+            continued = false;
+        }
+
+        stats_add(stats, Conversion_stats::bits_written, payload_bytes * 8 + bits_stored);
+
+        if (payload_bytes != packet_limit())
         {
             flush_bits();
         }
 
         if (payload_bytes != 0)
         {
-            unsigned int segments = (payload_bytes+segment_size)/segment_size;  // intentionally round up
-            if (segments == max_segments+1) segments = max_segments; // at max eschews the final 0
-
-            // move payload back
-            for (unsigned int i = 0; i < payload_bytes; i++)
-            {
-                page_buffer[header_bytes + segments + i] = page_buffer[header_bytes + max_segments + i];
-            }
-
-            page_buffer[0] = 'O';
-            page_buffer[1] = 'g';
-            page_buffer[2] = 'g';
-            page_buffer[3] = 'S';
-            page_buffer[4] = 0; // stream_structure_version
-            page_buffer[5] = (continued?1:0) | (first?2:0) | (last?4:0); // header_type_flag
-            write_32_le(&page_buffer[6], granule);  // granule low bits
-            write_32_le(&page_buffer[10], 0);       // granule high bits
-            if (granule == UINT32_C(0xFFFFFFFF))
-                write_32_le(&page_buffer[10], UINT32_C(0xFFFFFFFF));
-            write_32_le(&page_buffer[14], 1);       // stream serial number
-            write_32_le(&page_buffer[18], seqno);   // page sequence number
-            write_32_le(&page_buffer[22], 0);       // checksum (0 for now)
-            page_buffer[26] = segments;             // segment count
+            unsigned int page_segments = (payload_bytes+segment_size)/segment_size;  // intentionally round up
+            if (page_segments == max_segments+1) page_segments = max_segments; // at max eschews the final 0
 
             // lacing values
-            for (unsigned int i = 0, bytes_left = payload_bytes; i < segments; i++)
+            unsigned char * page_lacing = &page_buffer[header_bytes + max_segments - page_segments];
+            for (unsigned int i = 0, bytes_left = payload_bytes; i < page_segments; i++)
             {
                 if (bytes_left >= segment_size)
                 {
                     bytes_left -= segment_size;
-                    page_buffer[27 + i] = segment_size;
+                    page_lacing[i] = segment_size;
                 }
                 else
                 {
-                    page_buffer[27 + i] = bytes_left;
+                    page_lacing[i] = bytes_left;
                 }
             }
 
-            // checksum
-            write_32_le(&page_buffer[22],
-                    checksum(page_buffer, header_bytes + segments + payload_bytes)
-                    );
+            write_page(payload_bytes, page_segments, granule, last);
 
-            // output to ostream
-            for (unsigned int i = 0; i < header_bytes + segments + payload_bytes; i++)
-            {
-                os.put(page_buffer[i]);
-            }
-
-            seqno++;
-            first = false;
             continued = next_continued;
             payload_bytes = 0;
         }
@@ -325,6 +582,92 @@ public:
     }
 };
 
+// collect bits (LSB first) in memory, to be appended to a Bit_oggstream
+// as many times as needed
+class Bit_bufstream {
+    std::vector<unsigned char> bytes;
+
+    uint64_t bit_buffer;
+    unsigned int bits_stored;
+
+public:
+    Bit_bufstream() : bytes(), bit_buffer(0), bits_stored(0) {}
+
+    // n <= 32
+#ifdef WW2OGG_REFERENCE
+    void put_bits(uint32_t v, unsigned int n) {
+        for (unsigned int i = 0; i < n; i++) {
+            if (v & (1U << i)) bit_buffer |= 1U << bits_stored;
+            bits_stored ++;
+            if (bits_stored == 8) {
+                bytes.push_back(static_cast<unsigned char>(bit_buffer));
+                bit_buffer = 0;
+                bits_stored = 0;
+            }
+        }
+    }
+#else
+    void put_bits(uint32_t v, unsigned int n) {
+        bit_buffer |= (static_cast<uint64_t>(v) & ((static_cast<uint64_t>(1) << n) - 1)) << bits_stored;
+        bits_stored += n;
+
+        while (bits_stored >= 8)
+        {
+            bytes.push_back(static_cast<unsigned char>(bit_buffer));
+            bit_buffer >>= 8;
+            bits_stored -= 8;
+        }
+    }
+#endif
+
+    void put_bit(bool bit) {
+        put_bits(bit ? 1 : 0, 1);
+    }
+
+#ifdef WW2OGG_REFERENCE
+    void put_bytes(const unsigned char * data, unsigned long n) {
+        for (unsigned long i = 0; i < n; i++) {
+            put_bits(data[i], 8);
+        }
+    }
+#else
+    void put_bytes(const unsigned char * data, unsigned long n) {
+        if (n == 0) return;
+
+        std::vector<unsigned char>::size_type at = bytes.size();
+        bytes.resize(at + n);
+
+        if (bits_stored == 0)
+        {
+            memcpy(&bytes[at], data, n);
+        }
+        else
+        {
+            bit_buffer = funnel_shift_copy(&bytes[at], data, n, bits_stored,
+                    static_cast<unsigned char>(bit_buffer));
+        }
+    }
+#endif
+
+    unsigned long get_total_bits(void) const {
+        return bytes.size() * 8 + bits_stored;
+    }
+
+    // everything written, the last byte zero-padded
+    std::vector<unsigned char> get_bytes(void) const {
+        std::vector<unsigned char> all(bytes);
+        if (bits_stored != 0) all.push_back(static_cast<unsigned char>(bit_buffer));
+        return all;
+    }
+
+    // exactly the bits written, as if they went straight to bos
+    template <class Bit_out>
+    void append_to(Bit_out& bos) const {
+        if (!bytes.empty()) bos.put_bytes(&bytes[0], bytes.size());
+        if (bits_stored != 0) bos.put_bits(static_cast<uint32_t>(bit_buffer), bits_stored);
+    }
+};
+
 // integer of a certain number of bits, to allow reading just that many
 // bits from the Bit_stream
 template <unsigned int BIT_SIZE>
@@ -356,17 +699,17 @@ public:
     operator unsigned int() const { return total; }
 
     friend Bit_stream& operator >> (Bit_stream& bstream, Bit_uint& bui) {
-        bui.total = 0;
-        for ( unsigned int i = 0; i < BIT_SIZE; i++) {
-            if ( bstream.get_bit() ) bui.total |= (1U << i);
-        }
+        bui.total = bstream.get_bits(BIT_SIZE);
         return bstream;
     }
 
     friend Bit_oggstream& operator << (Bit_oggstream& bstream, const Bit_uint& bui) {
-        for ( unsigned int i = 0; i < BIT_SIZE; i++) {
-            bstream.put_bit((bui.total & (1U << i)) != 0);
-        }
+        bstream.put_bits(bui.total, BIT_SIZE);
+        return bstream;
+    }
+
+    friend Bit_bufstream& operator << (Bit_bufstream& bstream, const Bit_uint& bui) {
+        bstream.put_bits(bui.total, BIT_SIZE);
         return bstream;
     }
 };
@@ -402,40 +745,18 @@ public:
     operator unsigned int() const { return total; }
 
     friend Bit_stream& operator >> (Bit_stream& bstream, Bit_uintv& bui) {
-        bui.total = 0;
-        for ( unsigned int i = 0; i < bui.size; i++) {
-            if ( bstream.get_bit() ) bui.total |= (1U << i);
-        }
+        bui.total = bstream.get_bits(bui.size);
         return bstream;
     }
 
     friend Bit_oggstream& operator << (Bit_oggstream& bstream, const Bit_uintv& bui) {
-        for ( unsigned int i = 0; i < bui.size; i++) {
-            bstream.put_bit((bui.total & (1U << i)) != 0);
-        }
+        bstream.put_bits(bui.total, bui.size);
         return bstream;
     }
-};
 
-class array_streambuf : public std::streambuf
-{
-    // Intentionally undefined
-    array_streambuf& operator=(const array_streambuf& rhs);
-    array_streambuf(const array_streambuf &rhs);
-
-    char * arr;
-        
-public:
-    array_streambuf(const char * a, int l) : arr(0)
-    {
-        arr = new char [l];
-        for (int i = 0; i < l; i++)
-            arr[i] = a[i];
-        setg(arr, arr, arr+l);
-    }
-    ~array_streambuf()
-    {
-        delete [] arr;
+    friend Bit_bufstream& operator << (Bit_bufstream& bstream, const Bit_uintv& bui) {
+        bstream.put_bits(bui.total, bui.size);
+        return bstream;
     }
 };
 
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include "libww2ogg.h"
+#include "synthetic_wem.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace {
+
+void usage(void)
+{
+    cout << endl;
+    cout << "usage: ww2ogg_bench [--files n] [--packets n] [--repeat n] [--corpus directory]" << endl << endl;
+    cout << "Converts a made up corpus of each Wwise layout from memory to memory" << endl;
+    cout << "and reports the best of the repeats; --corpus also saves the files." << endl << endl;
+}
+
+bool parse_count(const char * s, unsigned int& n)
+{
+    char * end;
+    long v = strtol(s, &end, 10);
+    if (*end || end == s || v < 1 || v > 1000000) return false;
+    n = v;
+    return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int files = 20;
+    unsigned int packets = 1000;
+    unsigned int repeat = 5;
+    string corpus_dir;
+
+    for (int i = 1; i < argc; i++)
+    {
+        unsigned int * count = NULL;
+        if (!strcmp(argv[i], "--files")) count = &files;
+        else if (!strcmp(argv[i], "--packets")) count = &packets;
+        else if (!strcmp(argv[i], "--repeat")) count = &repeat;
+        else if (!strcmp(argv[i], "--corpus") && i+1 < argc)
+        {
+            corpus_dir = argv[++i];
+            continue;
+        }
+
+        if (!count || i+1 >= argc || !parse_count(argv[i+1], *count))
+        {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+
+    char error[256];
+    ww2ogg_codebooks * codebooks = ww2ogg_codebooks_load(NULL, error, sizeof(error));
+    if (!codebooks)
+    {
+        cout << error << endl;
+        return 1;
+    }
+
+    ww2ogg_options options;
+    ww2ogg_default_options(&options);
+    options.codebooks = codebooks;
+
+    ww2ogg_buffer out;
+    memset(&out, 0, sizeof(out));
+
+    cout << left << setw(16) << "layout" << right << setw(7) << "files" << setw(10) << "MB in"
+         << setw(10) << "MB/s" << setw(10) << "files/s" << endl;
+    cout << fixed << setprecision(2);
+
+    double total_bytes = 0, total_seconds = 0;
+    unsigned int total_files = 0;
+    int ret = 0;
+
+    for (int l = 0; l < Synthetic_wem::layout_count && 0 == ret; l++)
+    {
+        const Synthetic_wem::Layout layout = static_cast<Synthetic_wem::Layout>(l);
+
+        // alternately RIFF and RIFX, seeded by layout and number
+        vector<string> corpus;
+        double bytes = 0;
+        for (unsigned int i = 0; i < files; i++)
+        {
+            Synthetic_wem spec(layout);
+            spec.rifx = (i % 2 == 1);
+            spec.packets = packets;
+            corpus.push_back(spec.generate((l+1) * 100003 + i));
+            bytes += corpus.back().size();
+
+            if (!corpus_dir.empty())
+            {
+                string name = Synthetic_wem::layout_name(layout);
+                for (size_t j = 0; j < name.size(); j++)
+                {
+                    if (' ' == name[j]) name[j] = '-';
+                }
+
+                ostringstream filename;
+                filename << corpus_dir << "/" << name << "-" << setfill('0') << setw(3) << i << ".wem";
+
+                ofstream of(filename.str().c_str(), ios::binary);
+                of.write(corpus.back().data(), corpus.back().size());
+                if (!of)
+                {
+                    cout << "Error writing " << filename.str() << endl;
+                    ret = 1;
+                    break;
+                }
+            }
+        }
+
+        double best = 0;
+        for (unsigned int r = 0; r < repeat && 0 == ret; r++)
+        {
+            const uint64_t start = monotonic_ns();
+            for (unsigned int i = 0; i < corpus.size(); i++)
+            {
+                out.size = 0;
+                if (WW2OGG_OK != ww2ogg_convert(corpus[i].data(), corpus[i].size(),
+                            ww2ogg_buffer_sink, &out, &options, error, sizeof(error)))
+                {
+                    cout << Synthetic_wem::layout_name(layout) << " file " << i << ": " << error << endl;
+                    ret = 1;
+                    break;
+                }
+            }
+            const double elapsed = (monotonic_ns() - start) / 1e9;
+            if (0 == r || elapsed < best) best = elapsed;
+        }
+        if (0 != ret) break;
+
+        // nothing measurable on a coarse clock
+        if (best <= 0) best = 1e-9;
+
+        cout << left << setw(16) << Synthetic_wem::layout_name(layout) << right << setw(7) << files
+             << setw(10) << bytes / 1e6 << setw(10) << bytes / 1e6 / best << setw(10) << files / best << endl;
+
+        total_bytes += bytes;
+        total_files += files;
+        total_seconds += best;
+    }
+
+    if (0 == ret && total_seconds > 0)
+    {
+        cout << left << setw(16) << "all" << right << setw(7) << total_files << setw(10) << total_bytes / 1e6
+             << setw(10) << total_bytes / 1e6 / total_seconds << setw(10) << total_files / total_seconds << endl;
+    }
+
+    ww2ogg_buffer_free(&out);
+    ww2ogg_codebooks_free(codebooks);
+
+    return ret;
+}
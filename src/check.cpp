@@ -0,0 +1,503 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "libww2ogg.h"
+#include "input_buffer.h"
+#include "codebook.h"
+#include "synthetic_wem.h"
+
+#if defined(__linux__)
+#define HAVE_MADVISE_CHECK
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+#ifdef HAVE_MADVISE_CHECK
+namespace {
+
+struct Advice
+{
+    const unsigned char * start;
+    size_t length;
+};
+
+vector<Advice> sequential_advice;
+
+}
+
+// stands in for the C library's, which the library's calls then reach;
+// it's only a hint, so nothing is lost by not passing it on
+extern "C" int madvise(void * addr, size_t length, int advice) throw()
+{
+    if (MADV_SEQUENTIAL == advice)
+    {
+        Advice a = {static_cast<const unsigned char *>(addr), length};
+        sequential_advice.push_back(a);
+    }
+    return 0;
+}
+#endif
+
+namespace {
+
+const string work_dir = "check.tmp";
+
+void usage(void)
+{
+    cout << endl;
+    cout << "usage: ww2ogg_check" << endl << endl;
+    cout << "Checks what the conversions can't show: that hints reach the system" << endl;
+    cout << "and that damaged codebook libraries and cache entries are turned away." << endl << endl;
+}
+
+bool write_file(const string& name, const string& contents)
+{
+    ofstream of(name.c_str(), ios::binary);
+    of.write(contents.data(), contents.size());
+    return static_cast<bool>(of);
+}
+
+string read_file(const string& name)
+{
+    ifstream is(name.c_str(), ios::binary);
+    ostringstream s;
+    s << is.rdbuf();
+    return s.str();
+}
+
+uint32_t get_32_le(const string& s, size_t offset)
+{
+    return read_32_le(reinterpret_cast<const unsigned char *>(&s[offset]));
+}
+
+void set_32_le(string& s, size_t offset, uint32_t v)
+{
+    unsigned char b[4];
+    write_32_le(b, v);
+    s.replace(offset, 4, reinterpret_cast<char *>(b), 4);
+}
+
+// one check, which says why it failed
+class Check
+{
+    string name;
+    bool failed;
+
+public:
+    explicit Check(const string& n) : name(n), failed(false) {}
+
+    void expect(bool ok, const string& what)
+    {
+        if (ok) return;
+        cout << "FAIL " << name << ": " << what << endl;
+        failed = true;
+    }
+
+    bool passed(void) const
+    {
+        if (!failed) cout << "ok   " << name << endl;
+        return !failed;
+    }
+};
+
+#ifdef HAVE_MADVISE_CHECK
+// convert size bytes at data, expecting page-aligned MADV_SEQUENTIAL
+// advice over some of them
+void expect_sequential_advice(Check& check, const unsigned char * data, long size)
+{
+    ww2ogg_buffer out = {NULL, 0, 0};
+    char error[1024] = "";
+
+    sequential_advice.clear();
+    int result = ww2ogg_convert(data, size, ww2ogg_buffer_sink, &out, NULL, error, sizeof(error));
+    ww2ogg_buffer_free(&out);
+
+    check.expect(WW2OGG_OK == result, error);
+    check.expect(!sequential_advice.empty(), "no MADV_SEQUENTIAL");
+
+    // for the audio, somewhere in the input
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < sequential_advice.size(); i++)
+    {
+        const Advice& a = sequential_advice[i];
+        check.expect(0 == reinterpret_cast<uintptr_t>(a.start) % page, "MADV_SEQUENTIAL not page-aligned");
+        check.expect(a.start < data + size && a.start + a.length > data, "MADV_SEQUENTIAL outside the input");
+    }
+}
+#endif
+
+// converting a mapped file, as ww2ogg does, or the caller's own memory
+// wherever it starts, advises the audio as sequential
+bool check_sequential_advice(void)
+{
+#ifdef HAVE_MADVISE_CHECK
+    Check check("sequential advice on the input");
+
+    Synthetic_wem spec(Synthetic_wem::vorb_2A);
+    spec.packets = 2000;
+    const string wem = spec.generate(1);
+    const string input_name = work_dir + "/input.wem";
+    check.expect(write_file(input_name, wem), "couldn't write the input");
+
+    {
+        Input_buffer input(input_name);
+        expect_sequential_advice(check, input.get_data(), input.get_size());
+    }
+    remove(input_name.c_str());
+
+    // a page and a byte in, so neither the start nor the audio is aligned
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    vector<unsigned char> memory(wem.size() + 2 * page);
+    unsigned char * unaligned = &memory[0] + (page - reinterpret_cast<uintptr_t>(&memory[0]) % page) + 1;
+    memcpy(unaligned, wem.data(), wem.size());
+    expect_sequential_advice(check, unaligned, wem.size());
+
+    return check.passed();
+#else
+    cout << "skip sequential advice on the input" << endl;
+    return true;
+#endif
+}
+
+// whether ww2ogg_codebooks_load takes a library with these contents
+bool codebooks_load(const string& contents)
+{
+    const string name = work_dir + "/codebooks.bin";
+    if (!write_file(name, contents)) return false;
+    ww2ogg_codebooks * codebooks = ww2ogg_codebooks_load(name.c_str(), NULL, 0);
+    remove(name.c_str());
+
+    ww2ogg_codebooks_free(codebooks);
+    return codebooks != NULL;
+}
+
+// codebook libraries with offsets that would have a codebook run outside
+// the file, or have a negative size, are refused when loaded
+bool check_codebook_offsets(void)
+{
+    Check check("damaged codebook library offsets");
+
+    const string packed = read_file("packed_codebooks.bin");
+    check.expect(packed.size() > 4, "couldn't read packed_codebooks.bin");
+    if (packed.size() <= 4) return check.passed();
+
+    check.expect(codebooks_load(packed), "refused packed_codebooks.bin");
+
+    // swap two neighbouring offsets
+    {
+        string damaged = packed;
+        const size_t table = get_32_le(packed, packed.size() - 4);
+        const uint32_t first = get_32_le(packed, table + 10*4);
+        set_32_le(damaged, table + 10*4, get_32_le(packed, table + 11*4));
+        set_32_le(damaged, table + 11*4, first);
+        check.expect(!codebooks_load(damaged), "took offsets out of order");
+    }
+
+    // the offset table not quite reaching the end
+    {
+        string damaged = packed;
+        damaged.insert(damaged.size() - 4, 2, '\0');
+        check.expect(!codebooks_load(damaged), "took an offset table short of the end");
+    }
+
+    ostringstream compiled;
+    {
+        codebook_library library(reinterpret_cast<const unsigned char *>(packed.data()), packed.size());
+        library.compile(compiled);
+    }
+    check.expect(codebooks_load(compiled.str()), "refused packed_codebooks.bin compiled");
+
+    // a codebook's bits past the end
+    {
+        string damaged = compiled.str();
+        size_t entry = 24;
+        while (entry + 24 <= damaged.size() && 0xFFFFFFFF == get_32_le(damaged, entry + 4)) entry += 24;
+        set_32_le(damaged, entry, damaged.size() - 1);
+        check.expect(!codebooks_load(damaged), "took a compiled codebook past the end");
+    }
+
+    return check.passed();
+}
+
+// convert with a setup cache in dir, false on failure
+bool convert_cached(const string& wem, const string& dir, string& ogg, string& error)
+{
+    ww2ogg_setup_cache * cache = ww2ogg_setup_cache_new(dir.c_str());
+    ww2ogg_options options;
+    ww2ogg_default_options(&options);
+    options.setup_cache = cache;
+
+    ww2ogg_buffer out = {NULL, 0, 0};
+    char message[1024] = "";
+    int result = ww2ogg_convert(wem.data(), wem.size(), ww2ogg_buffer_sink, &out, &options, message, sizeof(message));
+    ww2ogg_setup_cache_free(cache);
+
+    ogg.assign(reinterpret_cast<const char *>(out.data), out.size);
+    ww2ogg_buffer_free(&out);
+    error = message;
+    return WW2OGG_OK == result;
+}
+
+// the .setup files in dir
+vector<string> cache_files(const string& dir)
+{
+    vector<string> names;
+    DIR * d = opendir(dir.c_str());
+    if (!d) return names;
+    for (struct dirent * de = readdir(d); de; de = readdir(d))
+    {
+        const string name = de->d_name;
+        if (name.size() > 6 && name.substr(name.size() - 6) == ".setup") names.push_back(dir + "/" + name);
+    }
+    closedir(d);
+    return names;
+}
+
+// setup cache entries on disk that couldn't have come from the setup
+// packet they're filed under are a miss, and replaced
+bool check_setup_cache_entries(void)
+{
+    Check check("damaged setup cache entries");
+
+    const string dir = work_dir + "/cache";
+    mkdir(dir.c_str(), 0777);
+
+    const string wem = Synthetic_wem(Synthetic_wem::vorb_2A).generate(2);
+    string expected, error;
+    check.expect(convert_cached(wem, dir, expected, error), error);
+
+    const vector<string> files = cache_files(dir);
+    check.expect(files.size() == 1, "not one entry saved");
+    if (files.size() != 1) return check.passed();
+    const string good = read_file(files[0]);
+
+    // where the fields are
+    const size_t bits_read_at = 12 + get_32_le(good, 8);
+    const size_t mode_count_at = bits_read_at + 8 + (get_32_le(good, bits_read_at + 4) + 7) / 8;
+    const uint32_t mode_count = get_32_le(good, mode_count_at);
+    check.expect(mode_count >= 1 && good.size() == mode_count_at + 8 + mode_count, "unexpected entry layout");
+
+    vector<string> damages, damaged;
+
+    damages.push_back("the wrong mode bits");
+    damaged.push_back(good);
+    set_32_le(damaged.back(), mode_count_at + 4, get_32_le(good, mode_count_at + 4) + 1);
+
+    damages.push_back("too many modes");
+    damaged.push_back(good);
+    set_32_le(damaged.back(), mode_count_at, 65);
+    set_32_le(damaged.back(), mode_count_at + 4, 7);
+    damaged.back().append(65 - mode_count, '\1');
+
+    damages.push_back("more bits read than the setup packet has");
+    damaged.push_back(good);
+    set_32_le(damaged.back(), bits_read_at, get_32_le(good, bits_read_at) + 64);
+
+    for (size_t i = 0; i < damaged.size(); i++)
+    {
+        string ogg;
+        check.expect(write_file(files[0], damaged[i]), "couldn't write the entry");
+        check.expect(convert_cached(wem, dir, ogg, error), damages[i] + ": " + error);
+        check.expect(ogg == expected, damages[i] + ": different output");
+        check.expect(read_file(files[0]) == good, damages[i] + ": entry not replaced");
+    }
+
+    remove(files[0].c_str());
+    rmdir(dir.c_str());
+    return check.passed();
+}
+
+// the granule position of each Ogg page
+vector<uint64_t> page_granules(const string& ogg)
+{
+    vector<uint64_t> granules;
+    size_t at = 0;
+    while (at + 27 <= ogg.size() && 0 == ogg.compare(at, 4, "OggS"))
+    {
+        granules.push_back(get_32_le(ogg, at + 6) | static_cast<uint64_t>(get_32_le(ogg, at + 10)) << 32);
+        const unsigned int segments = static_cast<unsigned char>(ogg[at + 26]);
+        if (at + 27 + segments > ogg.size()) break;
+        size_t size = 27 + segments;
+        for (unsigned int i = 0; i < segments; i++) size += static_cast<unsigned char>(ogg[at + 27 + i]);
+        at += size;
+    }
+    return granules;
+}
+
+// convert with granules recomputed, checking each page's against the sum
+// of the overlapping halves of its blocks, clamped to the sample count at
+// the end
+void expect_recomputed_granules(Check& check, const Synthetic_wem& spec, uint32_t seed)
+{
+    Synthetic_wem::Audio audio;
+    const string wem = spec.generate(seed, &audio);
+
+    ww2ogg_options options;
+    ww2ogg_default_options(&options);
+    options.recompute_granules = 1;
+
+    ww2ogg_buffer out = {NULL, 0, 0};
+    char error[1024] = "";
+    int result = ww2ogg_convert(wem.data(), wem.size(), ww2ogg_buffer_sink, &out, &options, error, sizeof(error));
+    const string ogg(reinterpret_cast<const char *>(out.data), out.size);
+    ww2ogg_buffer_free(&out);
+
+    check.expect(WW2OGG_OK == result, error);
+    if (WW2OGG_OK != result) return;
+
+    // a page for each packet, after the three header pages
+    const vector<bool>& long_block = audio.long_block;
+    const vector<uint64_t> granules = page_granules(ogg);
+    check.expect(granules.size() == 3 + long_block.size(), "not a page for each packet");
+    if (granules.size() != 3 + long_block.size()) return;
+
+    uint64_t samples = 0;
+    for (size_t i = 0; i < long_block.size(); i++)
+    {
+        if (i > 0) samples += (audio.blocksize[long_block[i-1]] + audio.blocksize[long_block[i]]) / 4;
+        uint64_t expected = samples;
+        if (i + 1 == long_block.size() && expected > audio.sample_count) expected = audio.sample_count;
+
+        if (granules[3 + i] != expected)
+        {
+            ostringstream what;
+            what << "seed " << seed << " packet " << i << " granule " << granules[3 + i] << ", expected " << expected;
+            check.expect(false, what.str());
+            return;
+        }
+    }
+}
+
+// recomputed granules follow the modes' block sizes, and the last is
+// clamped to the sample count when the blocks run past it
+bool check_recomputed_granules(void)
+{
+    Check check("recomputed granules");
+
+    Synthetic_wem spec(Synthetic_wem::vorb_2A);
+
+    // a file with both short and long blocks
+    uint32_t seed = 1;
+    Synthetic_wem::Audio audio;
+    for (; seed < 100; seed++)
+    {
+        spec.generate(seed, &audio);
+        const vector<bool>& l = audio.long_block;
+        if (find(l.begin(), l.end(), false) != l.end() && find(l.begin(), l.end(), true) != l.end()) break;
+    }
+    check.expect(seed < 100, "no synthetic file mixes block sizes");
+    if (seed >= 100) return check.passed();
+
+    // where the blocks end
+    uint64_t samples = 0;
+    for (size_t i = 1; i < audio.long_block.size(); i++)
+    {
+        samples += (audio.blocksize[audio.long_block[i-1]] + audio.blocksize[audio.long_block[i]]) / 4;
+    }
+
+    // a sample count past that, and one short of it
+    spec.sample_count = static_cast<uint32_t>(samples + 100);
+    expect_recomputed_granules(check, spec, seed);
+    spec.sample_count = static_cast<uint32_t>(samples - 100);
+    expect_recomputed_granules(check, spec, seed);
+
+    return check.passed();
+}
+
+// a codebooks file that isn't there is an error, even one named like a
+// library that is built in; those are only had by "builtin:" names
+bool check_missing_codebooks(void)
+{
+    Check check("missing codebooks file and built in names");
+
+    const string wem = Synthetic_wem(Synthetic_wem::vorb_2A).generate(3);
+
+    // with the default library
+    string expected;
+    {
+        ww2ogg_buffer out = {NULL, 0, 0};
+        check.expect(WW2OGG_OK == ww2ogg_convert(wem.data(), wem.size(), ww2ogg_buffer_sink, &out, NULL, NULL, 0),
+                "couldn't convert");
+        expected.assign(reinterpret_cast<const char *>(out.data), out.size);
+        ww2ogg_buffer_free(&out);
+    }
+    const char * const names[] = {"packed_codebooks.bin", "packed_codebooks_aoTuV_603.bin"};
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        const string name = work_dir + "/" + names[i];
+
+        ww2ogg_options options;
+        ww2ogg_default_options(&options);
+        options.codebooks_filename = name.c_str();
+
+        ww2ogg_buffer out = {NULL, 0, 0};
+        int result = ww2ogg_convert(wem.data(), wem.size(), ww2ogg_buffer_sink, &out, &options, NULL, 0);
+        ww2ogg_buffer_free(&out);
+        check.expect(WW2OGG_ERROR_OPEN == result, "converted without " + name);
+
+        ww2ogg_codebooks * codebooks = ww2ogg_codebooks_load(name.c_str(), NULL, 0);
+        check.expect(!codebooks, "loaded " + name);
+        ww2ogg_codebooks_free(codebooks);
+
+        // the same library by its built in name, which is no file at all
+        const string builtin = string("builtin:") + names[i];
+        options.codebooks_filename = builtin.c_str();
+
+        string ogg;
+        result = ww2ogg_convert(wem.data(), wem.size(), ww2ogg_buffer_sink, &out, &options, NULL, 0);
+        ogg.assign(reinterpret_cast<const char *>(out.data), out.size);
+        ww2ogg_buffer_free(&out);
+        check.expect(WW2OGG_OK == result, "couldn't convert with " + builtin);
+        if (0 == i) check.expect(ogg == expected, "different output with " + builtin);
+
+        codebooks = ww2ogg_codebooks_load(builtin.c_str(), NULL, 0);
+        check.expect(codebooks != NULL, "couldn't load " + builtin);
+        ww2ogg_codebooks_free(codebooks);
+    }
+
+    // a built in name for no library that's built in
+    ww2ogg_codebooks * codebooks = ww2ogg_codebooks_load("builtin:packed_codebooks_missing.bin", NULL, 0);
+    check.expect(!codebooks, "loaded an unknown built in library");
+    ww2ogg_codebooks_free(codebooks);
+
+    return check.passed();
+}
+
+}
+
+int main(int argc, char **)
+{
+    if (argc > 1)
+    {
+        usage();
+        return 1;
+    }
+
+    mkdir(work_dir.c_str(), 0777);
+
+    unsigned int failed = 0;
+    if (!check_sequential_advice()) failed++;
+    if (!check_codebook_offsets()) failed++;
+    if (!check_setup_cache_entries()) failed++;
+    if (!check_recomputed_granules()) failed++;
+    if (!check_missing_codebooks()) failed++;
+
+    rmdir(work_dir.c_str());
+
+    if (failed)
+    {
+        cout << failed << " checks failed" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,41 +1,219 @@
 #define __STDC_CONSTANT_MACROS
+#include <cstring>
+#include <memory>
 #include "codebook.h"
+#include "embedded_codebooks.h"
+
+// translated codebooks are published with an atomic compare-and-swap, so a
+// library can be shared between threads; without that, translate each time
+#if defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+#define CODEBOOK_CACHE
+#endif
+
+namespace {
+
+template <class Bit_out>
+void copy_codebook(Bit_stream &bis, Bit_out& bos);
+
+template <class Bit_out>
+void rebuild_codebook(Bit_stream &bis, unsigned long cb_size, Bit_out& bos);
+
+}
+
+const char codebook_library::compiled_magic[8] = {'W','W','V','C','B','O','O','K'};
 
 codebook_library::codebook_library(void)
-    : codebook_data(NULL), codebook_offsets(NULL), codebook_count(0)
+    : file(NULL), compiled(false), codebook_data(NULL), codebook_offsets(NULL), codebook_count(0), identity(0), translated(NULL)
 { }
 
 codebook_library::codebook_library(const string& filename)
-    : codebook_data(NULL), codebook_offsets(NULL), codebook_count(0)
+    : file(NULL), compiled(false), codebook_data(NULL), codebook_offsets(NULL), codebook_count(0), identity(0), translated(NULL)
 {
-    ifstream is(filename.c_str(), ios::binary);
+    file = new Input_buffer(filename);
+    load();
+}
+
+codebook_library::codebook_library(const unsigned char * data, long size)
+    : file(NULL), compiled(false), codebook_data(NULL), codebook_offsets(NULL), codebook_count(0), identity(0), translated(NULL)
+{
+    file = new Input_buffer(data, size);
+    load();
+}
+
+void codebook_library::load(void)
+{
+    try
+    {
+        const unsigned char * data = file->get_data();
+        long file_size = file->get_size();
+
+        if (file_size >= compiled_header_size && !memcmp(data, compiled_magic, sizeof(compiled_magic)))
+        {
+            // compiled, nothing to do but check it fits
+            uint32_t count = read_32_le(&data[12]);
+
+            if (read_32_le(&data[8]) != compiled_version)
+            {
+                throw Parse_error_str("unsupported compiled codebook library version");
+            }
+            if (count > static_cast<unsigned long>(file_size - compiled_header_size) / compiled_entry_size)
+            {
+                throw Parse_error_str("compiled codebook library truncated");
+            }
 
-    if (!is) throw File_open_error(filename);
+            // every codebook's bits after the index and inside the file
+            const unsigned long index_end = compiled_header_size + count * compiled_entry_size;
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const unsigned char * entry = &data[compiled_header_size + i*compiled_entry_size];
+                uint32_t offset = read_32_le(&entry[0]);
+                uint32_t bits = read_32_le(&entry[4]);
+
+                if (compiled_untranslated == bits) continue;
+                if (offset < index_end || offset > static_cast<unsigned long>(file_size) ||
+                    (bits + UINT64_C(7)) / 8 > static_cast<unsigned long>(file_size) - offset)
+                {
+                    throw Parse_error_str("compiled codebook library offset out of range");
+                }
+            }
+
+            identity = read_32_le(&data[16]) | static_cast<uint64_t>(read_32_le(&data[20])) << 32;
+            compiled = true;
+            return;
+        }
+
+        if (file_size < 4) throw Parse_error_str("codebook library truncated");
 
-    is.seekg(0, ios::end);
-    long file_size = is.tellg();
+        long offset_offset = read_32_le(&data[file_size-4]);
+        if (offset_offset < 0 || offset_offset > file_size - 4) throw Parse_error_str("codebook library truncated");
 
-    is.seekg(file_size-4, ios::beg);
-    long offset_offset = read_32_le(is);
-    codebook_count = (file_size - offset_offset) / 4;
+        codebook_count = (file_size - offset_offset) / 4;
 
-    codebook_data = new char [offset_offset];
-    codebook_offsets = new long [codebook_count];
+        codebook_data = reinterpret_cast<const char *>(data);
+        codebook_offsets = new long [codebook_count];
 
-    is.seekg(0, ios::beg);
-    for (long i = 0; i < offset_offset; i++)
+        for (long i = 0; i < codebook_count; i++)
+        {
+            codebook_offsets[i] = read_32_le(&data[offset_offset + i*4]);
+            if (codebook_offsets[i] < 0 || codebook_offsets[i] > offset_offset ||
+                (i > 0 && codebook_offsets[i] < codebook_offsets[i-1]))
+            {
+                throw Parse_error_str("codebook library offset out of range");
+            }
+        }
+
+        // the last offset is the end of the data (the offset table's own)
+        if (codebook_offsets[codebook_count-1] != offset_offset)
+        {
+            throw Parse_error_str("codebook library offset out of range");
+        }
+
+        identity = hash_fnv1a(data, file_size);
+
+        translated = new Bit_bufstream * [codebook_count]();
+    }
+    catch (...)
     {
-        codebook_data[i] = is.get();
+        delete [] codebook_offsets;
+        delete file;
+        throw;
     }
+}
 
-    for (long i = 0; i < codebook_count; i++)
+namespace {
+
+// one library for each embedded_codebooks entry, set up before main
+class Builtin_libraries
+{
+    vector<const codebook_library *> libraries;
+
+    // Intentionally undefined
+    Builtin_libraries& operator=(const Builtin_libraries& rhs);
+    Builtin_libraries(const Builtin_libraries& rhs);
+
+public:
+    Builtin_libraries(void) : libraries()
     {
-        codebook_offsets[i] = read_32_le(is);
+        for (const embedded_file * e = embedded_codebooks; e->name; e++)
+        {
+            libraries.push_back(new codebook_library(e->data, e->size));
+        }
+    }
+
+    ~Builtin_libraries()
+    {
+        for (size_t i = 0; i < libraries.size(); i++)
+        {
+            delete libraries[i];
+        }
     }
+
+    const codebook_library * find(const string& filename) const
+    {
+        size_t slash = filename.find_last_of("/\\");
+        string base = (slash == string::npos) ? filename : filename.substr(slash + 1);
+
+        for (size_t i = 0; i < libraries.size(); i++)
+        {
+            if (base == embedded_codebooks[i].name) return libraries[i];
+        }
+        return NULL;
+    }
+};
+
+const Builtin_libraries builtin_libraries;
+
+}
+
+const codebook_library * builtin_codebook_library(const string& filename)
+{
+    return builtin_libraries.find(filename);
 }
 
-void codebook_library::rebuild(int i, Bit_oggstream& bos)
+const char builtin_codebooks_prefix[] = "builtin:";
+
+const codebook_library& open_codebook_library(const string& filename, auto_ptr<codebook_library>& owner)
 {
+    const string::size_type prefix_size = sizeof(builtin_codebooks_prefix) - 1;
+    if (0 == filename.compare(0, prefix_size, builtin_codebooks_prefix))
+    {
+        const codebook_library * builtin = builtin_codebook_library(filename.substr(prefix_size));
+        if (!builtin) throw File_open_error(filename);
+        return *builtin;
+    }
+
+    owner.reset(new codebook_library(filename));
+    return *owner;
+}
+
+void codebook_library::rebuild(int i, Bit_bufstream& bos) const
+{
+    if (compiled)
+    {
+        const unsigned char * data = file->get_data();
+        unsigned long file_size = file->get_size();
+
+        if (i < 0 || static_cast<uint32_t>(i) >= read_32_le(&data[12])) throw Invalid_id(i);
+
+        const unsigned char * entry = &data[compiled_header_size + i*compiled_entry_size];
+        uint32_t offset = read_32_le(&entry[0]);
+        uint32_t bits = read_32_le(&entry[4]);
+
+        if (compiled_untranslated == bits)
+        {
+            throw Parse_error_str("codebook couldn't be translated when compiled");
+        }
+        if (offset > file_size || (bits + 7) / 8 > file_size - offset)
+        {
+            throw Parse_error_str("compiled codebook library truncated");
+        }
+
+        bos.put_bytes(&data[offset], bits / 8);
+        if (bits % 8) bos.put_bits(data[offset + bits / 8], bits % 8);
+        return;
+    }
+
     const char * cb = get_codebook(i);
     unsigned long cb_size;
 
@@ -47,15 +225,172 @@ void codebook_library::rebuild(int i, Bit_oggstream& bos)
         cb_size = signed_cb_size;
     }
 
-    array_streambuf asb(cb, cb_size);
-    istream is(&asb);
-    Bit_stream bis(is);
+#ifdef CODEBOOK_CACHE
+    const Bit_bufstream * t = __atomic_load_n(&translated[i], __ATOMIC_ACQUIRE);
+    if (!t)
+    {
+        auto_ptr<Bit_bufstream> fresh(new Bit_bufstream);
+
+        try
+        {
+            Bit_stream bis(reinterpret_cast<const unsigned char *>(cb), cb_size);
+            rebuild_codebook(bis, cb_size, *fresh);
+        }
+        catch (...)
+        {
+            // nothing cached, but output what we got as far as before
+            fresh->append_to(bos);
+            throw;
+        }
+
+        // if another thread beat us to it, use theirs
+        Bit_bufstream * expected = NULL;
+        if (__atomic_compare_exchange_n(&translated[i], &expected, fresh.get(),
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            t = fresh.release();
+        }
+        else
+        {
+            t = expected;
+        }
+    }
+
+    t->append_to(bos);
+#else
+    Bit_stream bis(reinterpret_cast<const unsigned char *>(cb), cb_size);
 
     rebuild(bis, cb_size, bos);
+#endif
 }
 
-/* cb_size == 0 to not check size (for an inline bitstream) */
-void codebook_library::copy(Bit_stream &bis, Bit_oggstream& bos)
+// lookup type of a translated (standard Vorbis) codebook
+static unsigned int vorbis_lookup_type(const unsigned char * cb, unsigned long cb_size)
+{
+    Bit_stream bis(cb, cb_size);
+
+    Bit_uint<24> id;
+    Bit_uint<16> dimensions;
+    Bit_uint<24> entries;
+    Bit_uint<1> ordered;
+    bis >> id >> dimensions >> entries >> ordered;
+
+    if (ordered)
+    {
+        Bit_uint<5> initial_length;
+        bis >> initial_length;
+
+        unsigned int current_entry = 0;
+        while (current_entry < entries)
+        {
+            Bit_uintv number(ilog(entries-current_entry));
+            bis >> number;
+            current_entry += number;
+        }
+    }
+    else
+    {
+        Bit_uint<1> sparse;
+        bis >> sparse;
+
+        for (unsigned int i = 0; i < entries; i++)
+        {
+            Bit_uint<1> present(1);
+            if (sparse) bis >> present;
+
+            if (present)
+            {
+                Bit_uint<5> codeword_length;
+                bis >> codeword_length;
+            }
+        }
+    }
+
+    Bit_uint<4> lookup_type;
+    bis >> lookup_type;
+    return lookup_type;
+}
+
+void codebook_library::compile(ostream& os) const
+{
+    if (compiled || !codebook_offsets)
+    {
+        throw Parse_error_str("can only compile a packed codebook library");
+    }
+
+    uint32_t count = codebook_count - 1;
+
+    string header(compiled_magic, sizeof(compiled_magic));
+    string index;
+    string bits;
+
+    unsigned char b[4];
+    write_32_le(b, compiled_version);
+    header.append(reinterpret_cast<char *>(b), 4);
+    write_32_le(b, count);
+    header.append(reinterpret_cast<char *>(b), 4);
+    write_32_le(b, static_cast<uint32_t>(identity));
+    header.append(reinterpret_cast<char *>(b), 4);
+    write_32_le(b, static_cast<uint32_t>(identity >> 32));
+    header.append(reinterpret_cast<char *>(b), 4);
+
+    const unsigned long bits_start = compiled_header_size + count * compiled_entry_size;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t fields[6] = {static_cast<uint32_t>(bits_start + bits.size()), compiled_untranslated, 0, 0, 0, 0};
+
+        try
+        {
+            Bit_bufstream cb;
+            rebuild(i, cb);
+
+            vector<unsigned char> cb_bytes = cb.get_bytes();
+            const unsigned char * p = &cb_bytes[0];
+
+            fields[1] = cb.get_total_bits();
+            fields[2] = p[3] | p[4] << 8;                   // dimensions
+            fields[3] = p[5] | p[6] << 8 | p[7] << 16;      // entries
+            fields[4] = vorbis_lookup_type(p, cb_bytes.size());
+
+            bits.append(reinterpret_cast<const char *>(p), cb_bytes.size());
+        }
+        catch (const Parse_error&)
+        {
+            // left for conversion to report, should it ever be used
+        }
+
+        for (unsigned int j = 0; j < 6; j++)
+        {
+            write_32_le(b, fields[j]);
+            index.append(reinterpret_cast<char *>(b), 4);
+        }
+    }
+
+    os.write(header.data(), header.size());
+    os.write(index.data(), index.size());
+    os.write(bits.data(), bits.size());
+}
+
+void codebook_library::copy(Bit_stream &bis, Bit_oggstream& bos) const
+{
+    copy_codebook(bis, bos);
+}
+
+void codebook_library::copy(Bit_stream &bis, Bit_bufstream& bos) const
+{
+    copy_codebook(bis, bos);
+}
+
+void codebook_library::rebuild(Bit_stream &bis, unsigned long cb_size, Bit_bufstream& bos) const
+{
+    rebuild_codebook(bis, cb_size, bos);
+}
+
+namespace {
+
+template <class Bit_out>
+void copy_codebook(Bit_stream &bis, Bit_out& bos)
 {
     /* IN: 24 bit identifier, 16 bit dimensions, 24 bit entry count */
 
@@ -188,7 +523,8 @@ void codebook_library::copy(Bit_stream &bis, Bit_oggstream& bos)
 }
 
 /* cb_size == 0 to not check size (for an inline bitstream) */
-void codebook_library::rebuild(Bit_stream &bis, unsigned long cb_size, Bit_oggstream& bos)
+template <class Bit_out>
+void rebuild_codebook(Bit_stream &bis, unsigned long cb_size, Bit_out& bos)
 {
     /* IN: 4 bit dimensions, 14 bit entry count */
 
@@ -331,3 +667,5 @@ void codebook_library::rebuild(Bit_stream &bis, unsigned long cb_size, Bit_oggst
         throw Size_mismatch( cb_size, bis.get_total_bits_read()/8+1 );
     }
 }
+
+}
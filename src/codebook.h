@@ -6,8 +6,11 @@
 #include <string>
 #include <stdint.h>
 #include <cstdlib>
+#include <memory>
 #include "errors.h"
 #include "Bit_stream.h"
+#include "input_buffer.h"
+#include "hash.h"
 
 using namespace std;
 
@@ -49,24 +52,69 @@ unsigned int _book_maptype1_quantvals(unsigned int entries, unsigned int dimensi
 
 }
 
+/* A codebook library is either packed, Wwise's own stripped codebooks
+   translated to Vorbis on first use, or compiled, where that was done
+   ahead of time (see compile()) and the file is used as mapped:
+
+     header, 24 bytes
+        0  "WWVCBOOK"
+        8  32 bit format version
+       12  32 bit codebook count
+       16  64 bit identity of the packed library it came from
+     index, 24 bytes per codebook
+        0  32 bit offset of its bits in the file
+        4  32 bit length in bits, 0xFFFFFFFF if it failed to translate
+        8  32 bit dimensions
+       12  32 bit entries
+       16  32 bit lookup type
+       20  32 bit reserved (0)
+     each codebook's Vorbis bits, LSB first, starting on a byte
+
+   All little endian. */
 class codebook_library
 {
-    char * codebook_data;
+    Input_buffer * file;
+    bool compiled;
+
+    // packed
+    const char * codebook_data;
     long * codebook_offsets;
     long codebook_count;
 
+    uint64_t identity;
+
+    // each packed codebook translated to Vorbis form on first use, by id
+    Bit_bufstream ** translated;
+
+    enum {compiled_header_size = 24, compiled_entry_size = 24, compiled_version = 1};
+    static const char compiled_magic[8];
+    static const uint32_t compiled_untranslated = UINT32_C(0xFFFFFFFF);
+
     // Intentionally undefined
     codebook_library& operator=(const codebook_library& rhs);
     codebook_library(const codebook_library& rhs);
 
+    void load(void);
+
 public:
+    // either kind, told apart by contents
     codebook_library(const string& filename);
+    codebook_library(const unsigned char * data, long size);
     codebook_library(void);
 
     ~codebook_library()
     {
-        delete [] codebook_data;
+        if (translated)
+        {
+            for (long i = 0; i < codebook_count; i++)
+            {
+                delete translated[i];
+            }
+        }
+
+        delete [] translated;
         delete [] codebook_offsets;
+        delete file;
     }
 
     const char * get_codebook(int i) const
@@ -89,10 +137,35 @@ public:
         return codebook_offsets[i+1]-codebook_offsets[i];
     }
 
-    void rebuild(int i, Bit_oggstream& bos);
+    // identifies the packed codebooks (also for a library compiled from
+    // them), 0 if none loaded
+    uint64_t get_identity(void) const { return identity; }
+
+    bool is_compiled(void) const { return compiled; }
+
+    // write out a packed library in compiled form
+    void compile(ostream& os) const;
+
+    void rebuild(int i, Bit_bufstream& bos) const;
+
+    void rebuild(Bit_stream &bis, unsigned long cb_size, Bit_bufstream& bos) const;
 
-    void rebuild(Bit_stream &bis, unsigned long cb_size, Bit_oggstream& bos);
+    void copy(Bit_stream &bis, Bit_oggstream& bos) const;
 
-    void copy(Bit_stream &bis, Bit_oggstream& bos);
+    void copy(Bit_stream &bis, Bit_bufstream& bos) const;
 };
+
+// the library built in under this file name (any directory is ignored),
+// NULL if there isn't one
+const codebook_library * builtin_codebook_library(const string& filename);
+
+// names a built in library to open_codebook_library, as in
+// "builtin:packed_codebooks_aoTuV_603.bin"
+extern const char builtin_codebooks_prefix[];
+
+// the built in library for a name with builtin_codebooks_prefix, otherwise
+// the named file, left in owner; a file that can't be opened is an error,
+// never quietly a built in library instead
+const codebook_library& open_codebook_library(const string& filename, auto_ptr<codebook_library>& owner);
+
 #endif
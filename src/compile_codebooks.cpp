@@ -0,0 +1,46 @@
+#define __STDC_CONSTANT_MACROS
+#include <iostream>
+#include <fstream>
+#include "codebook.h"
+#include "errors.h"
+
+using namespace std;
+
+// translate a packed codebook library ahead of time, into the compiled
+// form ww2ogg can use straight from an mmap (--pcb accepts either)
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        cout << "usage: compile_codebooks packed_codebooks.bin packed_codebooks.vcb" << endl;
+        return 1;
+    }
+
+    try
+    {
+        codebook_library cbl(argv[1]);
+
+        ofstream of(argv[2], ios::binary);
+        if (!of) throw File_open_error(argv[2]);
+
+        cbl.compile(of);
+
+        if (!of)
+        {
+            cout << "Error writing " << argv[2] << endl;
+            return 1;
+        }
+    }
+    catch (const File_open_error& fe)
+    {
+        cout << fe << endl;
+        return 1;
+    }
+    catch (const Parse_error& pe)
+    {
+        cout << pe << endl;
+        return 1;
+    }
+
+    return 0;
+}
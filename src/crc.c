@@ -68,7 +68,8 @@ static uint32_t crc_lookup[256]={
   0xafb010b1,0xab710d06,0xa6322bdf,0xa2f33668,
   0xbcb4666d,0xb8757bda,0xb5365d03,0xb1f740b4};
 
-uint32_t checksum(unsigned char *data, int bytes){
+/* the plain one-byte-at-a-time loop, the reference for the others */
+static uint32_t checksum_table(unsigned char *data, int bytes){
   uint32_t crc_reg=0;
   int i;
 
@@ -77,3 +78,188 @@ uint32_t checksum(unsigned char *data, int bytes){
 
   return crc_reg;
 }
+
+/* slicing-by-16: crc_slice[k][b] is the register after byte b and then
+   k zero bytes, so 16 bytes are folded in with 16 independent lookups */
+static uint32_t crc_slice[16][256];
+
+static void crc_slice_init(void){
+  int i, k;
+
+  for(i=0;i<256;i++)
+    crc_slice[0][i]=crc_lookup[i];
+
+  for(k=1;k<16;k++)
+    for(i=0;i<256;i++)
+      crc_slice[k][i]=(crc_slice[k-1][i]<<8)^crc_lookup[crc_slice[k-1][i]>>24];
+}
+
+static uint32_t crc_update_slice16(uint32_t crc_reg, const unsigned char *data, int bytes){
+  while(bytes>=16){
+    uint32_t x=crc_reg^(((uint32_t)data[0]<<24)|((uint32_t)data[1]<<16)|
+                        ((uint32_t)data[2]<<8)|data[3]);
+
+    crc_reg=crc_slice[15][x>>24]^crc_slice[14][(x>>16)&0xff]^
+            crc_slice[13][(x>>8)&0xff]^crc_slice[12][x&0xff]^
+            crc_slice[11][data[4]]^crc_slice[10][data[5]]^
+            crc_slice[9][data[6]]^crc_slice[8][data[7]]^
+            crc_slice[7][data[8]]^crc_slice[6][data[9]]^
+            crc_slice[5][data[10]]^crc_slice[4][data[11]]^
+            crc_slice[3][data[12]]^crc_slice[2][data[13]]^
+            crc_slice[1][data[14]]^crc_slice[0][data[15]];
+
+    data+=16;
+    bytes-=16;
+  }
+
+  while(bytes-->0)
+    crc_reg=(crc_reg<<8)^crc_lookup[((crc_reg >> 24)&0xff)^*data++];
+
+  return crc_reg;
+}
+
+static uint32_t checksum_slice16(unsigned char *data, int bytes){
+  return crc_update_slice16(0,data,bytes);
+}
+
+/* x^n mod P, for the folding constants */
+static uint32_t crc_xpow(unsigned int n){
+  uint32_t r=1;
+
+  while(n--)
+    r=(r<<1)^((r&0x80000000)?0x04c11db7:0);
+
+  return r;
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CRC_PCLMUL
+#include <immintrin.h>
+
+static uint32_t crc_fold4_lo, crc_fold4_hi, crc_fold1_lo, crc_fold1_hi;
+
+/* Carry-less multiply folding. Blocks are loaded byte-reversed so that a
+   128-bit lane is the message polynomial with the first bit highest. A
+   lane is carried 128n bits forward by multiplying its halves by
+   x^(128n) and x^(128n+64) mod P; the remaining 128-bit remainder is then
+   just another 16 bytes of message for the table code. */
+__attribute__((target("pclmul,ssse3")))
+static __m128i crc_fold(__m128i a, __m128i k){
+  return _mm_xor_si128(_mm_clmulepi64_si128(a,k,0x00),
+                       _mm_clmulepi64_si128(a,k,0x11));
+}
+
+__attribute__((target("pclmul,ssse3")))
+static uint32_t checksum_pclmul(unsigned char *data, int bytes){
+  const __m128i bswap=_mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+  const __m128i k4=_mm_set_epi32(0,(int)crc_fold4_hi,0,(int)crc_fold4_lo);
+  const __m128i k1=_mm_set_epi32(0,(int)crc_fold1_hi,0,(int)crc_fold1_lo);
+  __m128i a0,a1,a2,a3;
+  unsigned char rem[16];
+
+  if(bytes<128)
+    return crc_update_slice16(0,data,bytes);
+
+  a0=_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+0)),bswap);
+  a1=_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+16)),bswap);
+  a2=_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+32)),bswap);
+  a3=_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+48)),bswap);
+  data+=64;
+  bytes-=64;
+
+  while(bytes>=64){
+    a0=_mm_xor_si128(crc_fold(a0,k4),
+        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+0)),bswap));
+    a1=_mm_xor_si128(crc_fold(a1,k4),
+        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+16)),bswap));
+    a2=_mm_xor_si128(crc_fold(a2,k4),
+        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+32)),bswap));
+    a3=_mm_xor_si128(crc_fold(a3,k4),
+        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+48)),bswap));
+    data+=64;
+    bytes-=64;
+  }
+
+  a1=_mm_xor_si128(crc_fold(a0,k1),a1);
+  a2=_mm_xor_si128(crc_fold(a1,k1),a2);
+  a3=_mm_xor_si128(crc_fold(a2,k1),a3);
+
+  while(bytes>=16){
+    a3=_mm_xor_si128(crc_fold(a3,k1),
+        _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data),bswap));
+    data+=16;
+    bytes-=16;
+  }
+
+  _mm_storeu_si128((__m128i *)rem,_mm_shuffle_epi8(a3,bswap));
+
+  return crc_update_slice16(crc_update_slice16(0,rem,16),data,bytes);
+}
+#endif
+
+/* check a candidate against the table loop before trusting it */
+static int checksum_self_test(uint32_t (*impl)(unsigned char *, int)){
+  unsigned char buf[1024];
+  uint32_t seed=1;
+  int i;
+
+  for(i=0;i<(int)sizeof(buf);i++){
+    seed=seed*1103515245+12345;
+    buf[i]=(unsigned char)(seed>>16);
+  }
+
+  for(i=0;i<=(int)sizeof(buf);i+=(i<300)?1:97)
+    if(impl(buf+(i&7),i-(i&7))!=checksum_table(buf+(i&7),i-(i&7)))
+      return 0;
+
+  return 1;
+}
+
+static uint32_t (*checksum_select(void))(unsigned char *, int){
+  crc_slice_init();
+
+#ifdef CRC_PCLMUL
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")){
+    crc_fold4_lo=crc_xpow(512);
+    crc_fold4_hi=crc_xpow(512+64);
+    crc_fold1_lo=crc_xpow(128);
+    crc_fold1_hi=crc_xpow(128+64);
+
+    if(checksum_self_test(checksum_pclmul))
+      return checksum_pclmul;
+  }
+#else
+  (void)crc_xpow;
+#endif
+
+  if(checksum_self_test(checksum_slice16))
+    return checksum_slice16;
+
+  return checksum_table;
+}
+
+static uint32_t (*checksum_impl)(unsigned char *, int)=0;
+
+/* choose at load time where the compiler lets us, so that concurrent
+   first calls don't race to set up the tables */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((constructor))
+#endif
+static void checksum_init(void){
+  checksum_impl=checksum_select();
+}
+
+uint32_t checksum(unsigned char *data, int bytes){
+#ifdef WW2OGG_REFERENCE
+  /* ww2ogg_reference checks the others against this */
+  return checksum_table(data,bytes);
+#else
+  if(!checksum_impl)
+    checksum_init();
+
+  return checksum_impl(data,bytes);
+#endif
+}
@@ -0,0 +1,472 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <dirent.h>
+#include "synthetic_wem.h"
+#include "errors.h"
+
+using namespace std;
+
+namespace {
+
+void usage(void)
+{
+    cout << endl;
+    cout << "usage: ww2ogg_difftest [--synthetic n] [--seed n] [--new ww2ogg] [--reference ww2ogg_reference]" << endl;
+    cout << "                       [--baseline ww2ogg_baseline [--pcb packed_codebooks.bin]]" << endl;
+    cout << "                       [--work directory] [input.wem | directory ...]" << endl << endl;
+    cout << "Converts each input, and n made up ones, with ww2ogg and with the bit at a" << endl;
+    cout << "time reference build, plain, with --pack-pages, with --recompute-granules" << endl;
+    cout << "and with -j 4 (the reference on one thread), and reports the first page," << endl;
+    cout << "packet and bit where the Ogg streams differ. With --baseline, also compares" << endl;
+    cout << "ww2ogg plain, with -j 4 and with a setup cache (twice, so the second finds" << endl;
+    cout << "every entry) to a build from before any of the fast paths, given the packed" << endl;
+    cout << "codebooks file." << endl << endl;
+}
+
+bool parse_count(const char * s, unsigned int& n)
+{
+    char * end;
+    long v = strtol(s, &end, 10);
+    if (*end || end == s || v < 0 || v > 1000000) return false;
+    n = v;
+    return true;
+}
+
+// the same inputs for the same seed
+class Random
+{
+    uint32_t state;
+
+public:
+    explicit Random(uint32_t seed) : state(seed ? seed : 1) {}
+
+    uint32_t next(void)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // 0 to n-1
+    uint32_t below(uint32_t n)
+    {
+        return n ? next() % n : 0;
+    }
+};
+
+// for the shell, in single quotes
+string quote(const string& s)
+{
+    string q = "'";
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        if ('\'' == s[i]) q += "'\\''";
+        else q += s[i];
+    }
+    return q + "'";
+}
+
+// all of a file, empty if it can't be read
+string read_file(const string& name)
+{
+    ifstream is(name.c_str(), ios::binary);
+    ostringstream s;
+    s << is.rdbuf();
+    return is ? s.str() : string();
+}
+
+// .wem files directly in a directory, as ww2ogg --batch takes them
+void add_directory(const string& dir_name, vector<string>& inputs)
+{
+    DIR * dir = opendir(dir_name.c_str());
+    if (!dir) throw File_open_error(dir_name);
+
+    vector<string> names;
+    for (struct dirent * de = readdir(dir); de; de = readdir(dir))
+    {
+        string name = de->d_name;
+        if (name.size() > 4 && (name.substr(name.size() - 4) == ".wem" || name.substr(name.size() - 4) == ".WEM"))
+        {
+            names.push_back(dir_name + "/" + name);
+        }
+    }
+    closedir(dir);
+
+    sort(names.begin(), names.end());
+    inputs.insert(inputs.end(), names.begin(), names.end());
+}
+
+// an empty setup cache directory, so entries from another build can't be
+// found in place of translating
+void clear_setup_cache(const string& dir_name)
+{
+    mkdir(dir_name.c_str(), 0777);
+
+    DIR * dir = opendir(dir_name.c_str());
+    if (!dir) return;
+
+    for (struct dirent * de = readdir(dir); de; de = readdir(dir))
+    {
+        const string name = de->d_name;
+        if ('.' != name[0]) remove((dir_name + "/" + name).c_str());
+    }
+    closedir(dir);
+}
+
+// where a page starts and how it's laid out
+struct Ogg_page
+{
+    size_t offset;
+    unsigned int segments;
+    size_t payload_offset;
+    size_t payload_size;
+};
+
+// the pages of an Ogg stream, false if it doesn't parse all the way
+bool split_pages(const string& ogg, vector<Ogg_page>& pages)
+{
+    size_t offset = 0;
+    while (offset < ogg.size())
+    {
+        if (ogg.size() - offset < 27 || ogg.compare(offset, 4, "OggS") != 0) return false;
+
+        Ogg_page page;
+        page.offset = offset;
+        page.segments = static_cast<unsigned char>(ogg[offset + 26]);
+        page.payload_offset = offset + 27 + page.segments;
+        if (page.payload_offset > ogg.size()) return false;
+
+        page.payload_size = 0;
+        for (unsigned int i = 0; i < page.segments; i++)
+        {
+            page.payload_size += static_cast<unsigned char>(ogg[offset + 27 + i]);
+        }
+        if (page.payload_size > ogg.size() - page.payload_offset) return false;
+
+        pages.push_back(page);
+        offset = page.payload_offset + page.payload_size;
+    }
+    return true;
+}
+
+// describe where new first differs from reference, empty if they're the
+// same; packets are counted from 0 at the start of the stream
+string first_difference(const string& reference, const string& fresh)
+{
+    if (reference == fresh) return "";
+
+    vector<Ogg_page> ref_pages, new_pages;
+    ostringstream s;
+    if (!split_pages(reference, ref_pages))
+    {
+        s << "reference output isn't an Ogg stream";
+        return s.str();
+    }
+    if (!split_pages(fresh, new_pages))
+    {
+        s << "new output isn't an Ogg stream";
+        return s.str();
+    }
+
+    unsigned long packet = 0;
+    unsigned long packet_bytes = 0;     // of the packet carried into the page
+    for (size_t p = 0; p < ref_pages.size() && p < new_pages.size(); p++)
+    {
+        const Ogg_page& rp = ref_pages[p];
+        const Ogg_page& np = new_pages[p];
+
+        // the payload first, as a bad one also changes the checksum
+        size_t d = 0;
+        while (d < rp.payload_size && d < np.payload_size &&
+                reference[rp.payload_offset + d] == fresh[np.payload_offset + d])
+        {
+            d++;
+        }
+
+        // find the packet with byte d by the reference page's lacing
+        unsigned long at_packet = packet, at_bytes = packet_bytes;
+        size_t segment_start = 0;
+        for (unsigned int i = 0; i < rp.segments; i++)
+        {
+            const unsigned int lacing = static_cast<unsigned char>(reference[rp.offset + 27 + i]);
+            if (d < segment_start + lacing) break;
+
+            segment_start += lacing;
+            at_bytes += lacing;
+            if (lacing < 255)
+            {
+                at_packet++;
+                at_bytes = 0;
+            }
+        }
+        const unsigned long bit = (at_bytes + d - segment_start) * 8;
+
+        if (d < rp.payload_size || d < np.payload_size)
+        {
+            s << "page " << p << " (at byte " << rp.offset << "), packet " << at_packet << ", bit ";
+            if (d < rp.payload_size && d < np.payload_size)
+            {
+                unsigned int x = static_cast<unsigned char>(reference[rp.payload_offset + d] ^ fresh[np.payload_offset + d]);
+                unsigned int low = 0;
+                while (!(x & 1))
+                {
+                    x >>= 1;
+                    low++;
+                }
+                s << bit + low << ": payload differs";
+            }
+            else
+            {
+                s << bit << ": payload is " << np.payload_size << " bytes, not " << rp.payload_size;
+            }
+            return s.str();
+        }
+
+        // then the header
+        static const struct { size_t at, size; const char * name; } fields[] = {
+            {4, 1, "version"}, {5, 1, "flags"}, {6, 8, "granule"}, {14, 4, "serial number"},
+            {18, 4, "sequence number"}, {26, 1 + 255, "lacing"}, {22, 4, "checksum"}
+        };
+        for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++)
+        {
+            size_t size = fields[f].size;
+            if (26 == fields[f].at) size = 1 + rp.segments;
+
+            if (reference.compare(rp.offset + fields[f].at, size, fresh, np.offset + fields[f].at, size) != 0)
+            {
+                s << "page " << p << " (at byte " << rp.offset << "), packet " << packet << ": " <<
+                    fields[f].name << " differs";
+                return s.str();
+            }
+        }
+
+        packet = at_packet;
+        packet_bytes = at_bytes;
+    }
+
+    s << "reference has " << ref_pages.size() << " pages, new has " << new_pages.size();
+    return s.str();
+}
+
+// one input converted both ways with one set of options
+class Comparison
+{
+    const string& fresh;
+    const string& reference;
+    const string& work;
+
+    // Intentionally undefined
+    Comparison& operator=(const Comparison& rhs);
+    Comparison(const Comparison& rhs);
+
+    // exit status, the output in ogg
+    static int convert(const string& exe, const string& input, const string& options, const string& output,
+            const string& log, string& ogg)
+    {
+        remove(output.c_str());
+        const string command = quote(exe) + " " + quote(input) + " -o " + quote(output) + options +
+            " > " + quote(log) + " 2>&1";
+        const int status = system(command.c_str());
+        ogg = read_file(output);
+        return status;
+    }
+
+public:
+    Comparison(const string& f, const string& r, const string& w) : fresh(f), reference(r), work(w) {}
+
+    // empty if they're the same
+    string run(const string& input, const string& options, const string& reference_options)
+    {
+        string ref_ogg, new_ogg;
+        const int ref_status = convert(reference, input, reference_options, work + "/reference.ogg",
+                work + "/reference.log", ref_ogg);
+        const int new_status = convert(fresh, input, options, work + "/new.ogg", work + "/new.log", new_ogg);
+
+        if ((0 == ref_status) != (0 == new_status))
+        {
+            return string("reference ") + (0 == ref_status ? "converted" : "failed") +
+                ", new " + (0 == new_status ? "converted" : "failed");
+        }
+
+        return first_difference(ref_ogg, new_ogg);
+    }
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int synthetic = 50;
+    unsigned int seed = 1;
+    string fresh = "./ww2ogg";
+    string reference = "./ww2ogg_reference";
+    string baseline;
+    string baseline_codebooks = "packed_codebooks.bin";
+    string work = "difftest.tmp";
+    vector<string> inputs;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (!strcmp(argv[i], "--synthetic") || !strcmp(argv[i], "--seed"))
+            {
+                unsigned int& n = strcmp(argv[i], "--seed") ? synthetic : seed;
+                if (i+1 >= argc || !parse_count(argv[i+1], n))
+                {
+                    usage();
+                    return 1;
+                }
+                i++;
+            }
+            else if (!strcmp(argv[i], "--new") || !strcmp(argv[i], "--reference") || !strcmp(argv[i], "--work") ||
+                     !strcmp(argv[i], "--baseline") || !strcmp(argv[i], "--pcb"))
+            {
+                string& s = !strcmp(argv[i], "--new") ? fresh : !strcmp(argv[i], "--reference") ? reference :
+                    !strcmp(argv[i], "--baseline") ? baseline : !strcmp(argv[i], "--pcb") ? baseline_codebooks : work;
+                if (i+1 >= argc)
+                {
+                    usage();
+                    return 1;
+                }
+                s = argv[++i];
+            }
+            else if (argv[i][0] == '-')
+            {
+                usage();
+                return 1;
+            }
+            else
+            {
+                struct stat st;
+                if (0 == stat(argv[i], &st) && S_ISDIR(st.st_mode)) add_directory(argv[i], inputs);
+                else inputs.push_back(argv[i]);
+            }
+        }
+    }
+    catch (const File_open_error& fe)
+    {
+        cout << fe << endl;
+        return 1;
+    }
+
+    mkdir(work.c_str(), 0777);
+
+    // the fast paths each option set goes through; the reference runs
+    // everything on one thread
+    static const char * const option_sets[] = {"", " --pack-pages", " --recompute-granules", " -j 4"};
+    static const char * const reference_option_sets[] = {"", " --pack-pages", " --recompute-granules", ""};
+    const unsigned int option_set_count = sizeof(option_sets) / sizeof(option_sets[0]);
+
+    // the reference shares all but the bit streams and checksum, so the
+    // parts it can't check (the packet index, setup cache, embedded
+    // codebooks and chunked output) are checked against the baseline,
+    // which has none of them and reads the codebooks from the file
+    const string setup_cache = work + "/setup_cache";
+    vector<string> baseline_option_sets;
+    if (!baseline.empty())
+    {
+        clear_setup_cache(setup_cache);
+        baseline_option_sets.push_back("");
+        baseline_option_sets.push_back(" -j 4");
+        baseline_option_sets.push_back(" --setup-cache " + quote(setup_cache));
+        baseline_option_sets.push_back(" --setup-cache " + quote(setup_cache));
+    }
+    const string baseline_options = " --pcb " + quote(baseline_codebooks);
+
+    Comparison comparison(fresh, reference, work);
+    Comparison baseline_comparison(fresh, baseline, work);
+    Random random(seed);
+    unsigned long compared = 0, differed = 0;
+    unsigned long baseline_compared = 0, baseline_differed = 0;
+
+    for (size_t i = 0; i < inputs.size() + synthetic; i++)
+    {
+        string input, name, setup_options;
+        if (i < inputs.size())
+        {
+            input = name = inputs[i];
+        }
+        else
+        {
+            // every layout and setup, RIFF and RIFX, short files to ones
+            // long enough to be split between threads, and packets up to
+            // past the most a page can hold
+            Synthetic_wem spec(static_cast<Synthetic_wem::Layout>(random.below(Synthetic_wem::layout_count)));
+            spec.setup = static_cast<Synthetic_wem::Setup>(random.below(3));
+            spec.rifx = random.below(2) != 0;
+            spec.packets = 1 + random.below(random.below(4) ? 1200 : 40);
+            spec.max_packet_size = 1 + random.below(random.below(50) ? 6000 : 70000);
+            const uint32_t file_seed = random.next();
+
+            if (Synthetic_wem::vorb_28 != spec.layout)
+            {
+                if (Synthetic_wem::inline_codebooks == spec.setup) setup_options = " --inline-codebooks";
+                if (Synthetic_wem::full_setup == spec.setup) setup_options = " --full-setup";
+            }
+
+            ostringstream s;
+            s << "synthetic " << Synthetic_wem::layout_name(spec.layout) << setup_options <<
+                (spec.rifx ? " RIFX" : " RIFF") << ", " << spec.packets << " packets of up to " <<
+                spec.max_packet_size << " bytes, seed " << file_seed;
+            name = s.str();
+
+            input = work + "/synthetic.wem";
+            const string wem = spec.generate(file_seed);
+            ofstream of(input.c_str(), ios::binary);
+            of.write(wem.data(), wem.size());
+            if (!of)
+            {
+                cout << "Error writing " << input << endl;
+                return 1;
+            }
+        }
+
+        for (unsigned int o = 0; o < option_set_count; o++)
+        {
+            const string difference = comparison.run(input, setup_options + option_sets[o],
+                    setup_options + reference_option_sets[o]);
+            compared++;
+
+            if (!difference.empty())
+            {
+                cout << "DIFF " << name << (*option_sets[o] ? " with" : "") << option_sets[o] << ": " <<
+                    difference << endl;
+                differed++;
+            }
+        }
+
+        for (size_t o = 0; o < baseline_option_sets.size(); o++)
+        {
+            const string difference = baseline_comparison.run(input, setup_options + baseline_option_sets[o],
+                    setup_options + baseline_options);
+            baseline_compared++;
+
+            if (!difference.empty())
+            {
+                cout << "DIFF " << name << (baseline_option_sets[o].empty() ? "" : " with") <<
+                    baseline_option_sets[o] << ", against the baseline: " << difference << endl;
+                baseline_differed++;
+            }
+        }
+    }
+
+    cout << compared - differed << " of " << compared << " conversions the same as the reference" << endl;
+    if (!baseline.empty())
+    {
+        cout << baseline_compared - baseline_differed << " of " << baseline_compared <<
+            " conversions the same as the baseline" << endl;
+    }
+
+    return (differed || baseline_differed) ? 1 : 0;
+}
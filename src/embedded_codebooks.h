@@ -0,0 +1,22 @@
+#ifndef _EMBEDDED_CODEBOOKS_H
+#define _EMBEDDED_CODEBOOKS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct embedded_file {
+  const char *name;
+  const unsigned char *data;
+  unsigned long size;
+};
+
+/* the packed codebook libraries built in, generated at build time by
+   embed_codebooks.sh; ends with a NULL name */
+extern const struct embedded_file embedded_codebooks[];
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include "funnel.h"
+
+/* x86 SIMD versions, picked at run time */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define FUNNEL_X86
+#include <immintrin.h>
+#endif
+
+typedef unsigned char (*funnel_func)(unsigned char *, const unsigned char *,
+                                     size_t, unsigned int, unsigned char);
+
+/* 64 bits at a time */
+static unsigned char funnel_scalar(unsigned char *dst, const unsigned char *src,
+                                   size_t bytes, unsigned int shift,
+                                   unsigned char carry)
+{
+  uint64_t c = carry;
+  size_t i = 0;
+  int j;
+
+  for (; i + 8 <= bytes; i += 8) {
+    uint64_t w = 0, o;
+
+    for (j = 7; j >= 0; j--)
+      w = (w << 8) | src[i+j];
+
+    o = (w << shift) | c;
+    c = w >> (64 - shift);
+
+    for (j = 0; j < 8; j++) {
+      dst[i+j] = (unsigned char)o;
+      o >>= 8;
+    }
+  }
+
+  for (; i < bytes; i++) {
+    dst[i] = (unsigned char)((src[i] << shift) | c);
+    c = src[i] >> (8 - shift);
+  }
+
+  return (unsigned char)c;
+}
+
+#ifdef FUNNEL_X86
+/* each output byte is the middle of a 16-bit (cur:prev) pair shifted right
+   by 8-shift; widen to 16-bit lanes, shift, and pack back down */
+
+__attribute__((target("sse2")))
+static unsigned char funnel_sse2(unsigned char *dst, const unsigned char *src,
+                                 size_t bytes, unsigned int shift,
+                                 unsigned char carry)
+{
+  __m128i count, mask;
+  size_t i;
+
+  if (bytes < 1 + 16)
+    return funnel_scalar(dst, src, bytes, shift, carry);
+
+  dst[0] = (unsigned char)((src[0] << shift) | carry);
+
+  count = _mm_cvtsi32_si128(8 - shift);
+  mask = _mm_set1_epi16(0xFF);
+
+  for (i = 1; i + 16 <= bytes; i += 16) {
+    __m128i cur = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i prev = _mm_loadu_si128((const __m128i *)(src + i - 1));
+    __m128i lo = _mm_srl_epi16(_mm_unpacklo_epi8(prev, cur), count);
+    __m128i hi = _mm_srl_epi16(_mm_unpackhi_epi8(prev, cur), count);
+
+    _mm_storeu_si128((__m128i *)(dst + i),
+        _mm_packus_epi16(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask)));
+  }
+
+  return funnel_scalar(dst + i, src + i, bytes - i, shift,
+                       (unsigned char)(src[i-1] >> (8 - shift)));
+}
+
+/* unpack and pack both work within 128-bit lanes, so byte order survives */
+__attribute__((target("avx2")))
+static unsigned char funnel_avx2(unsigned char *dst, const unsigned char *src,
+                                 size_t bytes, unsigned int shift,
+                                 unsigned char carry)
+{
+  __m128i count;
+  __m256i mask;
+  size_t i;
+
+  if (bytes < 1 + 32)
+    return funnel_scalar(dst, src, bytes, shift, carry);
+
+  dst[0] = (unsigned char)((src[0] << shift) | carry);
+
+  count = _mm_cvtsi32_si128(8 - shift);
+  mask = _mm256_set1_epi16(0xFF);
+
+  for (i = 1; i + 32 <= bytes; i += 32) {
+    __m256i cur = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i prev = _mm256_loadu_si256((const __m256i *)(src + i - 1));
+    __m256i lo = _mm256_srl_epi16(_mm256_unpacklo_epi8(prev, cur), count);
+    __m256i hi = _mm256_srl_epi16(_mm256_unpackhi_epi8(prev, cur), count);
+
+    _mm256_storeu_si256((__m256i *)(dst + i),
+        _mm256_packus_epi16(_mm256_and_si256(lo, mask),
+                            _mm256_and_si256(hi, mask)));
+  }
+
+  return funnel_scalar(dst + i, src + i, bytes - i, shift,
+                       (unsigned char)(src[i-1] >> (8 - shift)));
+}
+#endif
+
+static funnel_func funnel_select(void)
+{
+#ifdef FUNNEL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return funnel_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return funnel_sse2;
+#endif
+  return funnel_scalar;
+}
+
+static funnel_func funnel_impl = 0;
+
+/* choose at load time where the compiler lets us, so concurrent first
+   calls don't race */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((constructor))
+#endif
+static void funnel_init(void)
+{
+  funnel_impl = funnel_select();
+}
+
+unsigned char funnel_shift_copy(unsigned char *dst, const unsigned char *src,
+                                size_t bytes, unsigned int shift,
+                                unsigned char carry)
+{
+  if (!funnel_impl)
+    funnel_init();
+
+  return funnel_impl(dst, src, bytes, shift, carry);
+}
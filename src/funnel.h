@@ -0,0 +1,20 @@
+#ifndef _FUNNEL_H
+#define _FUNNEL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* copy bytes to a bit offset (LSB first); carry holds the pending low
+   shift bits, the new pending bits are returned (1 <= shift <= 7) */
+unsigned char funnel_shift_copy(unsigned char *dst, const unsigned char *src,
+                                size_t bytes, unsigned int shift,
+                                unsigned char carry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
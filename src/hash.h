@@ -0,0 +1,23 @@
+#ifndef _HASH_H
+#define _HASH_H
+
+#ifndef __STDC_CONSTANT_MACROS
+#define __STDC_CONSTANT_MACROS
+#endif
+#include <cstddef>
+#include <stdint.h>
+
+// 64-bit FNV-1a, for telling contents apart (not for security); pass the
+// previous result as h to continue a hash over more data
+inline uint64_t hash_fnv1a(const void * data, size_t bytes, uint64_t h = UINT64_C(0xcbf29ce484222325))
+{
+    const unsigned char * p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < bytes; i++)
+    {
+        h ^= p[i];
+        h *= UINT64_C(0x100000001b3);
+    }
+    return h;
+}
+
+#endif
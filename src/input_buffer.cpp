@@ -0,0 +1,95 @@
+#include <fstream>
+#include <stdint.h>
+#include "input_buffer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+Input_buffer::Input_buffer(const string& filename)
+    : data(NULL), size(0), mapped(false), owned(false)
+{
+#ifdef HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw File_open_error(filename);
+
+    struct stat st;
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void * p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED != p)
+        {
+            data = static_cast<const unsigned char *>(p);
+            size = st.st_size;
+            mapped = true;
+        }
+    }
+
+    close(fd);
+
+    if (mapped) return;
+#endif
+
+    // no mmap (or it failed), read the whole thing
+    ifstream is(filename.c_str(), ios::binary);
+    if (!is) throw File_open_error(filename);
+
+    is.seekg(0, ios::end);
+    long file_size = is.tellg();
+    if (file_size < 0) file_size = 0;
+    is.seekg(0, ios::beg);
+
+    unsigned char * buffer = new unsigned char [file_size > 0 ? file_size : 1];
+    is.read(reinterpret_cast<char *>(buffer), file_size);
+
+    data = buffer;
+    size = is.gcount();
+    owned = true;
+}
+
+Input_buffer::Input_buffer(const void * d, long s)
+    : data(static_cast<const unsigned char *>(d)), size(s), mapped(false), owned(false)
+{ }
+
+Input_buffer::~Input_buffer()
+{
+#ifdef HAVE_MMAP
+    if (mapped)
+    {
+        munmap(const_cast<unsigned char *>(data), size);
+        return;
+    }
+#endif
+    if (owned)
+    {
+        delete [] data;
+    }
+}
+
+void Input_buffer::advise_sequential(long offset, long bytes) const
+{
+#if defined(HAVE_MMAP) && defined(MADV_SEQUENTIAL)
+    // the caller's memory may well be a mapping too (ww2ogg's own is), and
+    // on anything else the hint does no harm; only a copy read in here is
+    // known not to be worth it
+    if (owned || offset < 0 || bytes <= 0 || offset >= size) return;
+    if (bytes > size - offset) bytes = size - offset;
+
+    // madvise wants a page-aligned address, which the caller's memory
+    // needn't start on
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0) return;
+    uintptr_t first = reinterpret_cast<uintptr_t>(data + offset);
+    uintptr_t start = first - first % page;
+
+    madvise(reinterpret_cast<void *>(start), first - start + bytes, MADV_SEQUENTIAL);
+#else
+    (void)offset;
+    (void)bytes;
+#endif
+}
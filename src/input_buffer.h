@@ -0,0 +1,76 @@
+#ifndef _INPUT_BUFFER_H
+#define _INPUT_BUFFER_H
+
+#include <string>
+#include "errors.h"
+
+using namespace std;
+
+// read-only image of a whole input file, mmapped where the platform
+// allows and otherwise read into memory, or a view of the caller's memory
+class Input_buffer
+{
+    const unsigned char * data;
+    long size;
+    bool mapped, owned;
+
+    // Intentionally undefined
+    Input_buffer& operator=(const Input_buffer& rhs);
+    Input_buffer(const Input_buffer& rhs);
+
+public:
+    explicit Input_buffer(const string& filename);
+    Input_buffer(const void * d, long s);
+    ~Input_buffer();
+
+    const unsigned char * get_data(void) const { return data; }
+    long get_size(void) const { return size; }
+
+    // bytes at offset, NULL if they run past the end
+    const unsigned char * get(long offset, long bytes) const
+    {
+        if (offset < 0 || bytes < 0 || offset > size || bytes > size - offset) return NULL;
+        return data + offset;
+    }
+
+    // up to bytes at offset, bytes is cut short if the file is
+    const unsigned char * get_available(long offset, unsigned long& bytes) const
+    {
+        if (offset < 0 || offset > size)
+        {
+            bytes = 0;
+            return data;
+        }
+        if (bytes > static_cast<unsigned long>(size - offset)) bytes = size - offset;
+        return data + offset;
+    }
+
+    // hint that this range is about to be read front to back, for a file
+    // mapped here or by the caller
+    void advise_sequential(long offset, long bytes) const;
+};
+
+// seekg/read-style sequential access to an Input_buffer
+class Input_cursor
+{
+    const Input_buffer& in;
+    long pos;
+    unsigned long seeks;
+
+public:
+    Input_cursor(const Input_buffer& i, long offset) : in(i), pos(offset), seeks(0) {}
+
+    void seek(long offset) { pos = offset; seeks++; }
+
+    unsigned long get_seeks(void) const { return seeks; }
+
+    const unsigned char * read(long bytes)
+    {
+        const unsigned char * p = in.get(pos, bytes);
+        if (!p) throw Parse_error_str("file truncated");
+        pos += bytes;
+        return p;
+    }
+};
+
+#endif
@@ -0,0 +1,427 @@
+#define __STDC_CONSTANT_MACROS
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <streambuf>
+#include "libww2ogg.h"
+#include "wwriff.h"
+#include "input_buffer.h"
+#include "codebook.h"
+#include "setup_cache.h"
+#include "stats.h"
+#include "errors.h"
+
+using namespace std;
+
+namespace {
+
+const char default_codebooks[] = "packed_codebooks.bin";
+
+// hand everything written through an ostream to a ww2ogg_sink
+class sink_streambuf : public streambuf
+{
+    ww2ogg_sink sink;
+    void * sink_ctx;
+    bool failed;
+
+    // Intentionally undefined
+    sink_streambuf& operator=(const sink_streambuf& rhs);
+    sink_streambuf(const sink_streambuf& rhs);
+
+protected:
+    virtual streamsize xsputn(const char * s, streamsize n)
+    {
+        if (failed || 0 != sink(sink_ctx, s, n))
+        {
+            failed = true;
+            return 0;
+        }
+        return n;
+    }
+
+    virtual int_type overflow(int_type c)
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+
+        char ch = traits_type::to_char_type(c);
+        return (1 == xsputn(&ch, 1)) ? c : traits_type::eof();
+    }
+
+public:
+    sink_streambuf(ww2ogg_sink s, void * ctx) : streambuf(), sink(s), sink_ctx(ctx), failed(false) {}
+
+    bool get_failed(void) const { return failed; }
+};
+
+void set_error(char * error, size_t error_size, const string& msg)
+{
+    if (!error || 0 == error_size) return;
+
+    size_t n = (msg.size() < error_size - 1) ? msg.size() : error_size - 1;
+    memcpy(error, msg.data(), n);
+    error[n] = '\0';
+}
+
+// copies a conversion's stats out however it ends
+class Stats_result
+{
+    const Conversion_stats& stats;
+    ww2ogg_stats * out;
+
+    // Intentionally undefined
+    Stats_result& operator=(const Stats_result& rhs);
+    Stats_result(const Stats_result& rhs);
+
+public:
+    Stats_result(const Conversion_stats& s, ww2ogg_stats * o) : stats(s), out(o), events(0) {}
+
+    unsigned int events;
+
+    ~Stats_result()
+    {
+        if (!out) return;
+
+        for (int i = 0; i < WW2OGG_STAGE_COUNT; i++)
+        {
+            out->seconds[i] = stats.get_ns(i) / 1e9;
+        }
+        for (int i = 0; i < WW2OGG_COUNTER_COUNT; i++)
+        {
+            out->counts[i] = stats.get_count(i);
+        }
+        for (int i = 0; i < WW2OGG_STAGE_COUNT; i++)
+        {
+            for (int j = 0; j < WW2OGG_EVENT_COUNT; j++)
+            {
+                out->events[i][j] = stats.get_events(i, j);
+            }
+        }
+        out->events_counted = events;
+
+        out->span_count = stats.get_span_count();
+        out->spans_dropped = 0;
+        if (out->span_count > WW2OGG_SPAN_MAX)
+        {
+            out->spans_dropped = out->span_count - WW2OGG_SPAN_MAX;
+            out->span_count = WW2OGG_SPAN_MAX;
+        }
+        for (unsigned int i = 0; i < out->span_count; i++)
+        {
+            const Conversion_stats::Span span = stats.get_span(i);
+            out->spans[i].stage = span.stage;
+            out->spans[i].start_ns = span.start_ns;
+            out->spans[i].end_ns = span.end_ns;
+        }
+    }
+};
+
+// the text the command line tool has always printed for an error
+template <class E>
+string describe(const E& e)
+{
+    ostringstream s;
+    s << e;
+    return s.str();
+}
+
+}
+
+struct ww2ogg_codebooks
+{
+    auto_ptr<codebook_library> owned;
+    const codebook_library * library;
+
+    // Intentionally undefined
+    ww2ogg_codebooks& operator=(const ww2ogg_codebooks& rhs);
+    ww2ogg_codebooks(const ww2ogg_codebooks& rhs);
+
+    // NULL for the built in packed_codebooks.bin
+    explicit ww2ogg_codebooks(const char * filename)
+        : owned(), library(builtin_codebook_library(default_codebooks))
+    {
+        if (filename) library = &open_codebook_library(filename, owned);
+    }
+};
+
+struct ww2ogg_setup_cache
+{
+    Setup_cache cache;
+
+    explicit ww2ogg_setup_cache(const char * dir) : cache(dir ? dir : "") {}
+};
+
+const char *ww2ogg_version(void)
+{
+    return VERSION;
+}
+
+void ww2ogg_default_options(ww2ogg_options *options)
+{
+    options->codebooks_filename = NULL;
+    options->codebooks = NULL;
+    options->setup_cache = NULL;
+    options->inline_codebooks = 0;
+    options->full_setup = 0;
+    options->packet_format = WW2OGG_PACKET_FORMAT_AUTO;
+    options->page_size = 0;
+    options->recompute_granules = 0;
+    options->threads = 1;
+    options->info = NULL;
+    options->info_ctx = NULL;
+    options->stats = NULL;
+    options->profile = 0;
+    options->trace = 0;
+}
+
+int ww2ogg_stats_enabled(void)
+{
+#ifdef WW2OGG_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+uint64_t ww2ogg_clock_ns(void)
+{
+    return monotonic_ns();
+}
+
+const char *ww2ogg_stage_name(int stage)
+{
+    return Conversion_stats::stage_name(stage);
+}
+
+const char *ww2ogg_counter_name(int counter)
+{
+    return Conversion_stats::counter_name(counter);
+}
+
+const char *ww2ogg_event_name(int event)
+{
+    return Perf_counters::event_name(event);
+}
+
+unsigned int ww2ogg_profile_events(char *error, size_t error_size)
+{
+    Perf_counters perf;
+    set_error(error, error_size, perf.get_error());
+    return perf.get_events();
+}
+
+void ww2ogg_stats_add(ww2ogg_stats *total, const ww2ogg_stats *stats)
+{
+    for (int i = 0; i < WW2OGG_STAGE_COUNT; i++)
+    {
+        total->seconds[i] += stats->seconds[i];
+    }
+    for (int i = 0; i < WW2OGG_COUNTER_COUNT; i++)
+    {
+        total->counts[i] += stats->counts[i];
+    }
+    for (int i = 0; i < WW2OGG_STAGE_COUNT; i++)
+    {
+        for (int j = 0; j < WW2OGG_EVENT_COUNT; j++)
+        {
+            total->events[i][j] += stats->events[i][j];
+        }
+    }
+    total->events_counted |= stats->events_counted;
+}
+
+ww2ogg_codebooks *ww2ogg_codebooks_load(const char *filename,
+                                        char *error, size_t error_size)
+{
+    set_error(error, error_size, "");
+
+    try
+    {
+        return new ww2ogg_codebooks(filename);
+    }
+    catch (const File_open_error& fe)
+    {
+        set_error(error, error_size, describe(fe));
+    }
+    catch (const bad_alloc&)
+    {
+        set_error(error, error_size, "out of memory");
+    }
+    catch (...)
+    {
+        set_error(error, error_size, "unexpected error");
+    }
+
+    return NULL;
+}
+
+void ww2ogg_codebooks_free(ww2ogg_codebooks *codebooks)
+{
+    delete codebooks;
+}
+
+ww2ogg_setup_cache *ww2ogg_setup_cache_new(const char *dir)
+{
+    try
+    {
+        return new ww2ogg_setup_cache(dir);
+    }
+    catch (...)
+    {
+        return NULL;
+    }
+}
+
+void ww2ogg_setup_cache_free(ww2ogg_setup_cache *cache)
+{
+    delete cache;
+}
+
+int ww2ogg_convert(const void *in, size_t in_len,
+                   ww2ogg_sink sink, void *sink_ctx,
+                   const ww2ogg_options *options,
+                   char *error, size_t error_size)
+{
+    ww2ogg_options defaults;
+    if (!options)
+    {
+        ww2ogg_default_options(&defaults);
+        options = &defaults;
+    }
+
+    set_error(error, error_size, "");
+
+    Conversion_stats stats;
+    Stats_result stats_result(stats, options->stats);
+
+    if (!sink)
+    {
+        set_error(error, error_size, "no sink given");
+        return WW2OGG_ERROR_INTERNAL;
+    }
+
+    if (in_len > static_cast<size_t>(LONG_MAX))
+    {
+        set_error(error, error_size, describe(Parse_error_str("input too large")));
+        return WW2OGG_ERROR_PARSE;
+    }
+
+    try
+    {
+        // opened here so they count this thread
+        auto_ptr<Perf_counters> perf;
+        if (options->stats && options->profile && ww2ogg_stats_enabled())
+        {
+            perf.reset(new Perf_counters);
+            stats.set_perf(perf.get());
+            stats_result.events = perf->get_events();
+        }
+        if (options->stats && options->trace) stats.set_tracing();
+
+        ForcePacketFormat force_packet_format = kNoForcePacketFormat;
+        if (WW2OGG_PACKET_FORMAT_MOD == options->packet_format)
+        {
+            force_packet_format = kForceModPackets;
+        }
+        else if (WW2OGG_PACKET_FORMAT_STANDARD == options->packet_format)
+        {
+            force_packet_format = kForceNoModPackets;
+        }
+
+        // with no file named, the built in codebooks, without touching disk
+        const codebook_library * codebooks = NULL;
+        if (options->codebooks) codebooks = options->codebooks->library;
+        else if (!options->codebooks_filename) codebooks = builtin_codebook_library(default_codebooks);
+
+        Input_buffer input(in, static_cast<long>(in_len));
+        Wwise_RIFF_Vorbis ww(input,
+                options->codebooks_filename ? options->codebooks_filename : default_codebooks,
+                codebooks,
+                options->setup_cache ? &options->setup_cache->cache : NULL,
+                options->stats ? &stats : NULL,
+                options->inline_codebooks || options->full_setup,
+                options->full_setup,
+                force_packet_format
+                );
+
+        if (options->info)
+        {
+            ostringstream info;
+            ww.print_info(info);
+
+            if (0 != options->info(options->info_ctx, info.str().c_str()))
+            {
+                set_error(error, error_size, "stopped before output");
+                return WW2OGG_ERROR_ABORTED;
+            }
+        }
+
+        sink_streambuf sb(sink, sink_ctx);
+        ostream os(&sb);
+
+        ww.generate_ogg(os, options->page_size > 0 ? options->page_size : 0,
+                options->recompute_granules != 0, options->threads > 1 ? options->threads : 1);
+
+        if (sb.get_failed())
+        {
+            set_error(error, error_size, "error writing output");
+            return WW2OGG_ERROR_OUTPUT;
+        }
+    }
+    catch (const File_open_error& fe)
+    {
+        set_error(error, error_size, describe(fe));
+        return WW2OGG_ERROR_OPEN;
+    }
+    catch (const Parse_error& pe)
+    {
+        set_error(error, error_size, describe(pe));
+        return WW2OGG_ERROR_PARSE;
+    }
+    catch (const bad_alloc&)
+    {
+        set_error(error, error_size, "out of memory");
+        return WW2OGG_ERROR_INTERNAL;
+    }
+    catch (...)
+    {
+        set_error(error, error_size, "unexpected error");
+        return WW2OGG_ERROR_INTERNAL;
+    }
+
+    return WW2OGG_OK;
+}
+
+int ww2ogg_buffer_sink(void *ctx, const void *data, size_t bytes)
+{
+    ww2ogg_buffer *buffer = static_cast<ww2ogg_buffer *>(ctx);
+
+    if (bytes > buffer->capacity - buffer->size)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : 0x10000;
+        while (capacity - buffer->size < bytes)
+        {
+            capacity *= 2;
+        }
+
+        void *p = realloc(buffer->data, capacity);
+        if (!p) return 1;
+
+        buffer->data = static_cast<unsigned char *>(p);
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, bytes);
+    buffer->size += bytes;
+
+    return 0;
+}
+
+void ww2ogg_buffer_free(ww2ogg_buffer *buffer)
+{
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
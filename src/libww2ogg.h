@@ -0,0 +1,203 @@
+#ifndef _LIBWW2OGG_H
+#define _LIBWW2OGG_H
+
+/* in-memory Wwise RIFF/RIFX Vorbis to Ogg Vorbis conversion
+
+   Calls share no mutable state, so separate conversions may run on
+   separate threads at once. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum ww2ogg_result {
+    WW2OGG_OK = 0,
+    WW2OGG_ERROR_OPEN,      /* couldn't open the packed codebooks file */
+    WW2OGG_ERROR_PARSE,     /* input isn't something we can convert */
+    WW2OGG_ERROR_OUTPUT,    /* the sink reported a failure */
+    WW2OGG_ERROR_ABORTED,   /* the info callback asked to stop */
+    WW2OGG_ERROR_INTERNAL   /* anything else, e.g. out of memory */
+};
+
+enum ww2ogg_packet_format {
+    WW2OGG_PACKET_FORMAT_AUTO = 0,      /* guess from the vorb chunk */
+    WW2OGG_PACKET_FORMAT_MOD,           /* as --mod-packets */
+    WW2OGG_PACKET_FORMAT_STANDARD       /* as --no-mod-packets */
+};
+
+/* stages of a conversion, each timed on its own (the audio doesn't
+   include the checksums or output done in it) */
+enum ww2ogg_stage {
+    WW2OGG_STAGE_RIFF = 0,      /* reading the RIFF chunks */
+    WW2OGG_STAGE_CODEBOOKS,     /* loading and translating codebooks */
+    WW2OGG_STAGE_SETUP,         /* the rest of the Vorbis headers */
+    WW2OGG_STAGE_AUDIO,         /* the audio packets */
+    WW2OGG_STAGE_CHECKSUM,      /* Ogg page CRCs */
+    WW2OGG_STAGE_OUTPUT,        /* in the sink */
+    WW2OGG_STAGE_COUNT
+};
+
+enum ww2ogg_counter {
+    WW2OGG_COUNT_PACKETS = 0,   /* audio packets */
+    WW2OGG_COUNT_PAGES,
+    WW2OGG_COUNT_BYTES_IN,
+    WW2OGG_COUNT_BYTES_OUT,
+    WW2OGG_COUNT_SEEKS,         /* among the RIFF chunks */
+    WW2OGG_COUNT_BITS_READ,     /* of the setup and audio packets */
+    WW2OGG_COUNT_BITS_WRITTEN,  /* into Ogg packets, before padding */
+    WW2OGG_COUNTER_COUNT
+};
+
+/* hardware events counted in each stage with the profile option, in
+   user space on the converting thread only */
+enum ww2ogg_event {
+    WW2OGG_EVENT_CYCLES = 0,
+    WW2OGG_EVENT_INSTRUCTIONS,
+    WW2OGG_EVENT_BRANCH_MISSES,
+    WW2OGG_EVENT_CACHE_MISSES,
+    WW2OGG_EVENT_COUNT
+};
+
+/* when a stage ran, for a timeline; with nested stages (codebooks in
+   setup) the inner one ends first */
+typedef struct ww2ogg_span {
+    int stage;                          /* enum ww2ogg_stage */
+    uint64_t start_ns;                  /* as ww2ogg_clock_ns */
+    uint64_t end_ns;
+} ww2ogg_span;
+
+#define WW2OGG_SPAN_MAX 16
+
+/* where a conversion's time went and how much it did; all zero unless
+   the library was built with WW2OGG_STATS (see ww2ogg_stats_enabled).
+   The events of checksums and output, done per page, are counted in the
+   stage around them rather than read per page, so theirs are zero. */
+typedef struct ww2ogg_stats {
+    double seconds[WW2OGG_STAGE_COUNT];
+    uint64_t counts[WW2OGG_COUNTER_COUNT];
+    uint64_t events[WW2OGG_STAGE_COUNT][WW2OGG_EVENT_COUNT];
+    unsigned int events_counted;        /* bit (1 << event) set for each
+                                           event in events */
+    ww2ogg_span spans[WW2OGG_SPAN_MAX]; /* with the trace option, in the
+                                           order they ended; checksums and
+                                           output, done per page, have
+                                           none */
+    unsigned int span_count;
+    unsigned int spans_dropped;         /* how many more there were than
+                                           fit in spans, the last ones */
+} ww2ogg_stats;
+
+/* a loaded packed codebooks file, read-only once loaded so it can be
+   shared by any number of conversions, including concurrent ones. Both
+   libraries that come with ww2ogg are built in: packed_codebooks.bin is
+   used when no file is named, and either is named with "builtin:" before
+   its file name, e.g. "builtin:packed_codebooks_aoTuV_603.bin". Any other
+   name is a file, and an error if it can't be opened. */
+typedef struct ww2ogg_codebooks ww2ogg_codebooks;
+
+/* translated setup headers, so files sharing a setup packet only have it
+   translated once; safe to share between concurrent conversions */
+typedef struct ww2ogg_setup_cache ww2ogg_setup_cache;
+
+/* receives the Ogg stream, one page at a time; return nonzero to fail */
+typedef int (*ww2ogg_sink)(void *ctx, const void *data, size_t bytes);
+
+/* called once the input has been parsed and before any output, with the
+   same description the command line tool prints; return nonzero to stop */
+typedef int (*ww2ogg_info_func)(void *ctx, const char *info);
+
+typedef struct ww2ogg_options {
+    const char *codebooks_filename;     /* NULL for the built in
+                                           "packed_codebooks.bin", or a
+                                           "builtin:" name as for
+                                           ww2ogg_codebooks_load */
+    const ww2ogg_codebooks *codebooks;  /* if not NULL, used instead of
+                                           loading codebooks_filename */
+    ww2ogg_setup_cache *setup_cache;    /* may be NULL */
+    int inline_codebooks;
+    int full_setup;                     /* implies inline_codebooks */
+    int packet_format;                  /* enum ww2ogg_packet_format */
+    int page_size;                      /* 0 for a page per audio packet,
+                                           otherwise pack audio packets into
+                                           pages of about this many bytes */
+    int recompute_granules;             /* count granules from the block
+                                           sizes instead of using the stored
+                                           ones, where the mode table is
+                                           known (not with full setup or
+                                           the header triad) */
+    int threads;                        /* convert a long file's audio
+                                           packets on this many threads
+                                           (with a page per packet) */
+    ww2ogg_info_func info;              /* may be NULL */
+    void *info_ctx;
+    ww2ogg_stats *stats;                /* if not NULL, filled in however
+                                           the conversion ends */
+    int profile;                        /* also count hardware events into
+                                           stats, where they can be */
+    int trace;                          /* also keep spans in stats */
+} ww2ogg_options;
+
+/* output collected in memory, grown as needed with realloc */
+typedef struct ww2ogg_buffer {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} ww2ogg_buffer;
+
+const char *ww2ogg_version(void);
+
+void ww2ogg_default_options(ww2ogg_options *options);
+
+/* nonzero if conversions can fill in a ww2ogg_stats */
+int ww2ogg_stats_enabled(void);
+
+/* nanoseconds from some fixed point, as in ww2ogg_span */
+uint64_t ww2ogg_clock_ns(void);
+
+/* short names for the JSON keys, e.g. "riff" and "bytes_in" */
+const char *ww2ogg_stage_name(int stage);
+const char *ww2ogg_counter_name(int counter);
+const char *ww2ogg_event_name(int event);
+
+/* a bit (1 << event) for each event the profile option can count on this
+   thread; for any it can't, why is left in error (if not NULL) */
+unsigned int ww2ogg_profile_events(char *error, size_t error_size);
+
+/* add stats to total, e.g. for a batch (but not the spans) */
+void ww2ogg_stats_add(ww2ogg_stats *total, const ww2ogg_stats *stats);
+
+/* filename NULL for the built in "packed_codebooks.bin" (see
+   ww2ogg_codebooks for the others); NULL on failure,
+   with a message left in error (if not NULL) */
+ww2ogg_codebooks *ww2ogg_codebooks_load(const char *filename,
+                                        char *error, size_t error_size);
+
+void ww2ogg_codebooks_free(ww2ogg_codebooks *codebooks);
+
+/* dir NULL to keep entries in memory only, otherwise they are also
+   loaded from and saved to that (existing) directory across runs */
+ww2ogg_setup_cache *ww2ogg_setup_cache_new(const char *dir);
+
+void ww2ogg_setup_cache_free(ww2ogg_setup_cache *cache);
+
+/* Convert in_len bytes at in, passing the Ogg stream to sink. options may
+   be NULL for the defaults. On failure a message is left in error (if
+   not NULL); anything already passed to the sink is incomplete. */
+int ww2ogg_convert(const void *in, size_t in_len,
+                   ww2ogg_sink sink, void *sink_ctx,
+                   const ww2ogg_options *options,
+                   char *error, size_t error_size);
+
+/* sink appending to a ww2ogg_buffer (sink_ctx), which starts zeroed */
+int ww2ogg_buffer_sink(void *ctx, const void *data, size_t bytes);
+
+void ww2ogg_buffer_free(ww2ogg_buffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,456 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include "Bit_stream.h"
+#include "codebook.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace {
+
+void usage(void)
+{
+    cout << endl;
+    cout << "usage: ww2ogg_microbench [--repeat n] [--ms n] [name ...]" << endl << endl;
+    cout << "Times the bit I/O, checksum and codebook translation kernels on their" << endl;
+    cout << "own, each over n samples of about --ms milliseconds, and reports the" << endl;
+    cout << "mean time per op with its spread. Names pick the benchmarks whose name" << endl;
+    cout << "contains any of them." << endl << endl;
+}
+
+bool parse_count(const char * s, unsigned int& n)
+{
+    char * end;
+    long v = strtol(s, &end, 10);
+    if (*end || end == s || v < 1 || v > 1000000) return false;
+    n = v;
+    return true;
+}
+
+// the same input on every run
+class Random
+{
+    uint32_t state;
+
+public:
+    explicit Random(uint32_t seed) : state(seed ? seed : 1) {}
+
+    uint32_t next(void)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+vector<unsigned char> random_bytes(unsigned long size, uint32_t seed)
+{
+    Random random(seed);
+    vector<unsigned char> bytes(size);
+    for (unsigned long i = 0; i < size; i++)
+    {
+        bytes[i] = static_cast<unsigned char>(random.next() >> 24);
+    }
+    return bytes;
+}
+
+// throws the output away, so only the writing is timed
+class Null_streambuf : public streambuf
+{
+protected:
+    virtual int_type overflow(int_type c) { return traits_type::not_eof(c); }
+    virtual streamsize xsputn(const char *, streamsize n) { return n; }
+};
+
+// results are added here so the work can't be optimized away
+volatile uint32_t result_sink;
+
+// one kernel, run some number of ops per sample
+class Microbench
+{
+public:
+    virtual ~Microbench() {}
+
+    virtual string name(void) const = 0;
+
+    // input handled per op, for the rate
+    virtual double bytes_per_op(void) const = 0;
+
+    virtual void run(unsigned long ops) = 0;
+};
+
+// Bit_uint<N> extraction from a Bit_stream
+template <unsigned int N>
+class Read_bits : public Microbench
+{
+    vector<unsigned char> data;
+
+public:
+    Read_bits(void) : data(random_bytes(65536, N)) {}
+
+    string name(void) const
+    {
+        ostringstream s;
+        s << "read Bit_uint<" << N << ">";
+        return s.str();
+    }
+
+    double bytes_per_op(void) const { return N / 8.0; }
+
+    void run(unsigned long ops)
+    {
+        const unsigned long per_buffer = data.size() * 8 / N;
+        uint32_t sum = 0;
+        while (ops)
+        {
+            Bit_stream bis(&data[0], data.size());
+            const unsigned long n = (ops < per_buffer) ? ops : per_buffer;
+            for (unsigned long i = 0; i < n; i++)
+            {
+                Bit_uint<N> v;
+                bis >> v;
+                sum += v;
+            }
+            ops -= n;
+        }
+        result_sink += sum;
+    }
+};
+
+// Bit_uintv extraction of mixed widths, 1 to 32 bits
+class Read_bitsv : public Microbench
+{
+    vector<unsigned char> data;
+    vector<unsigned int> widths;
+    unsigned long width_bits;
+
+public:
+    Read_bitsv(void) : data(random_bytes(65536, 99)), widths(4096), width_bits(0)
+    {
+        Random random(7);
+        for (size_t i = 0; i < widths.size(); i++)
+        {
+            widths[i] = 1 + random.next() % 32;
+            width_bits += widths[i];
+        }
+    }
+
+    string name(void) const { return "read Bit_uintv"; }
+
+    double bytes_per_op(void) const { return width_bits / 8.0 / widths.size(); }
+
+    void run(unsigned long ops)
+    {
+        uint32_t sum = 0;
+        while (ops)
+        {
+            // the widths add up to well under the buffer
+            Bit_stream bis(&data[0], data.size());
+            const unsigned long n = (ops < widths.size()) ? ops : widths.size();
+            for (unsigned long i = 0; i < n; i++)
+            {
+                Bit_uintv v(widths[i]);
+                bis >> v;
+                sum += v;
+            }
+            ops -= n;
+        }
+        result_sink += sum;
+    }
+};
+
+// Bit_uint<N> writes into Bit_oggstream packets of the largest size, so
+// the page flushes hardly count
+template <unsigned int N>
+class Write_bits : public Microbench
+{
+    Null_streambuf null;
+    ostream os;
+    Bit_oggstream bos;
+
+    // Intentionally undefined
+    Write_bits& operator=(const Write_bits& rhs);
+    Write_bits(const Write_bits& rhs);
+
+public:
+    Write_bits(void) : null(), os(&null), bos(os) {}
+
+    string name(void) const
+    {
+        ostringstream s;
+        s << "write Bit_uint<" << N << ">";
+        return s.str();
+    }
+
+    double bytes_per_op(void) const { return N / 8.0; }
+
+    void run(unsigned long ops)
+    {
+        const unsigned long per_packet = 65000UL * 8 / N;
+        uint32_t v = 0x5A5A5A5A;
+        while (ops)
+        {
+            const unsigned long n = (ops < per_packet) ? ops : per_packet;
+            for (unsigned long i = 0; i < n; i++)
+            {
+                bos << Bit_uint<N>(v & ((static_cast<uint64_t>(1) << N) - 1));
+                v = v * 1103515245 + 12345;
+            }
+            bos.end_packet();
+            ops -= n;
+        }
+    }
+};
+
+// a packet of a given size put out with flush_page: the lacing, header,
+// checksum and output of one page
+class Flush_page : public Microbench
+{
+    unsigned int packet_bytes;
+    vector<unsigned char> packet;
+    Null_streambuf null;
+    ostream os;
+    Bit_oggstream bos;
+
+    // Intentionally undefined
+    Flush_page& operator=(const Flush_page& rhs);
+    Flush_page(const Flush_page& rhs);
+
+public:
+    explicit Flush_page(unsigned int bytes) : packet_bytes(bytes), packet(random_bytes(bytes, bytes)),
+        null(), os(&null), bos(os) {}
+
+    string name(void) const
+    {
+        ostringstream s;
+        s << "flush_page " << packet_bytes << " bytes";
+        return s.str();
+    }
+
+    double bytes_per_op(void) const { return packet_bytes; }
+
+    void run(unsigned long ops)
+    {
+        for (unsigned long i = 0; i < ops; i++)
+        {
+            bos.put_bytes(&packet[0], packet.size());
+            bos.flush_page();
+        }
+    }
+};
+
+// CRC of a whole page
+class Checksum : public Microbench
+{
+    vector<unsigned char> page;
+
+public:
+    explicit Checksum(unsigned int bytes) : page(random_bytes(bytes, bytes + 1)) {}
+
+    string name(void) const
+    {
+        ostringstream s;
+        s << "checksum " << page.size() << " bytes";
+        return s.str();
+    }
+
+    double bytes_per_op(void) const { return page.size(); }
+
+    void run(unsigned long ops)
+    {
+        uint32_t sum = 0;
+        for (unsigned long i = 0; i < ops; i++)
+        {
+            sum += checksum(&page[0], page.size());
+        }
+        result_sink += sum;
+    }
+};
+
+// translating packed codebooks to Vorbis, one per op, going through all
+// of a built in library in turn
+class Rebuild : public Microbench
+{
+    string library_name;
+    const codebook_library * library;
+    vector<int> ids;        // those that translate
+    unsigned long packed_bytes;
+
+    // Intentionally undefined
+    Rebuild& operator=(const Rebuild& rhs);
+    Rebuild(const Rebuild& rhs);
+
+    void rebuild(int id) const
+    {
+        Bit_stream bis(reinterpret_cast<const unsigned char *>(library->get_codebook(id)),
+                library->get_codebook_size(id));
+        Bit_bufstream bos;
+        library->rebuild(bis, library->get_codebook_size(id), bos);
+        result_sink += bos.get_total_bits();
+    }
+
+public:
+    explicit Rebuild(const string& name) : library_name(name), library(builtin_codebook_library(name)),
+        ids(), packed_bytes(0)
+    {
+        if (!library) throw File_open_error(name);
+
+        for (int i = 0; library->get_codebook(i); i++)
+        {
+            try
+            {
+                rebuild(i);
+            }
+            catch (const Parse_error&)
+            {
+                continue;
+            }
+            ids.push_back(i);
+            packed_bytes += library->get_codebook_size(i);
+        }
+    }
+
+    string name(void) const
+    {
+        ostringstream s;
+        s << "rebuild " << library_name << " (" << ids.size() << ")";
+        return s.str();
+    }
+
+    double bytes_per_op(void) const { return ids.empty() ? 0 : static_cast<double>(packed_bytes) / ids.size(); }
+
+    void run(unsigned long ops)
+    {
+        if (ids.empty()) return;
+
+        for (unsigned long i = 0; i < ops; i++)
+        {
+            rebuild(ids[i % ids.size()]);
+        }
+    }
+};
+
+// time one sample of ops, in ns
+double sample(Microbench& bench, unsigned long ops)
+{
+    const uint64_t start = monotonic_ns();
+    bench.run(ops);
+    return static_cast<double>(monotonic_ns() - start);
+}
+
+void measure(Microbench& bench, unsigned int repeat, unsigned int ms)
+{
+    // double the ops until a sample takes long enough, which also warms
+    // up the caches
+    unsigned long ops = 1;
+    while (sample(bench, ops) < ms * 1e6 && ops < (1UL << 30))
+    {
+        ops *= 2;
+    }
+
+    vector<double> ns_per_op(repeat);
+    double mean = 0;
+    for (unsigned int r = 0; r < repeat; r++)
+    {
+        ns_per_op[r] = sample(bench, ops) / ops;
+        mean += ns_per_op[r];
+    }
+    mean /= repeat;
+
+    double variance = 0, best = ns_per_op[0];
+    for (unsigned int r = 0; r < repeat; r++)
+    {
+        variance += (ns_per_op[r] - mean) * (ns_per_op[r] - mean);
+        if (ns_per_op[r] < best) best = ns_per_op[r];
+    }
+    if (repeat > 1) variance /= repeat - 1;
+
+    const double spread = mean > 0 ? 100 * sqrt(variance) / mean : 0;
+    const double rate = mean > 0 ? bench.bytes_per_op() / mean * 1e3 : 0;
+
+    cout << left << setw(44) << bench.name() << right << setprecision(2) << setw(12) << mean
+         << setw(7) << spread << "%" << setw(12) << best << setw(12) << rate << endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int repeat = 10;
+    unsigned int ms = 20;
+    vector<string> only;
+
+    for (int i = 1; i < argc; i++)
+    {
+        unsigned int * count = NULL;
+        if (!strcmp(argv[i], "--repeat")) count = &repeat;
+        else if (!strcmp(argv[i], "--ms")) count = &ms;
+        else if (argv[i][0] != '-')
+        {
+            only.push_back(argv[i]);
+            continue;
+        }
+
+        if (!count || i+1 >= argc || !parse_count(argv[i+1], *count))
+        {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+
+    vector<Microbench *> benches;
+    try
+    {
+        benches.push_back(new Read_bits<1>);
+        benches.push_back(new Read_bits<4>);
+        benches.push_back(new Read_bits<8>);
+        benches.push_back(new Read_bits<16>);
+        benches.push_back(new Read_bits<32>);
+        benches.push_back(new Read_bitsv);
+        benches.push_back(new Write_bits<1>);
+        benches.push_back(new Write_bits<8>);
+        benches.push_back(new Write_bits<32>);
+        // a typical audio packet, a packed page and the largest packet
+        benches.push_back(new Flush_page(200));
+        benches.push_back(new Flush_page(4096));
+        benches.push_back(new Flush_page(65025));
+        // pages of those packets, with header and lacing
+        benches.push_back(new Checksum(228));
+        benches.push_back(new Checksum(4140));
+        benches.push_back(new Checksum(65307));
+        benches.push_back(new Rebuild("packed_codebooks.bin"));
+        benches.push_back(new Rebuild("packed_codebooks_aoTuV_603.bin"));
+    }
+    catch (const File_open_error& fe)
+    {
+        cout << fe << endl;
+        return 1;
+    }
+
+    cout << left << setw(44) << "benchmark" << right << setw(12) << "ns/op" << setw(8) << "+/-"
+         << setw(12) << "min ns/op" << setw(12) << "MB/s" << endl;
+    cout << fixed;
+
+    for (size_t b = 0; b < benches.size(); b++)
+    {
+        bool wanted = only.empty();
+        for (size_t i = 0; i < only.size() && !wanted; i++)
+        {
+            wanted = benches[b]->name().find(only[i]) != string::npos;
+        }
+
+        if (wanted) measure(*benches[b], repeat, ms);
+        delete benches[b];
+    }
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <cerrno>
+#include <cstring>
+#include "perf_counters.h"
+
+#ifdef __linux__
+#define HAVE_PERF_EVENTS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char * Perf_counters::event_name(int event)
+{
+    static const char * const names[event_count] = {
+        "cycles", "instructions", "branch_misses", "cache_misses"
+    };
+    return (event >= 0 && event < event_count) ? names[event] : "";
+}
+
+#ifdef HAVE_PERF_EVENTS
+
+Perf_counters::Perf_counters(void) : fds(), leader(-1), group_index(), counted(0), error()
+{
+    static const uint64_t configs[event_count] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+
+    for (int i = 0; i < event_count; i++)
+    {
+        fds[i] = -1;
+        group_index[i] = -1;
+
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = (-1 == leader) ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        const long fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fd < 0)
+        {
+            if (error.empty())
+            {
+                error = string("perf_event_open for ") + event_name(i) + ": " + strerror(errno);
+            }
+            continue;
+        }
+
+        fds[i] = fd;
+        group_index[i] = counted++;
+        if (-1 == leader) leader = fd;
+    }
+
+    if (-1 != leader) ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+Perf_counters::~Perf_counters()
+{
+    for (int i = 0; i < event_count; i++)
+    {
+        if (-1 != fds[i]) close(fds[i]);
+    }
+}
+
+bool Perf_counters::read(uint64_t values[event_count]) const
+{
+    for (int i = 0; i < event_count; i++)
+    {
+        values[i] = 0;
+    }
+    if (-1 == leader) return false;
+
+    // the count, then each value in the order they joined the group
+    uint64_t group[1 + event_count];
+    const ssize_t size = ::read(leader, group, sizeof(group));
+    if (size < static_cast<ssize_t>(sizeof(uint64_t) * (1 + counted)) || group[0] != static_cast<uint64_t>(counted))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < event_count; i++)
+    {
+        if (-1 != group_index[i]) values[i] = group[1 + group_index[i]];
+    }
+    return true;
+}
+
+#else
+
+Perf_counters::Perf_counters(void) : fds(), leader(-1), group_index(), counted(0),
+    error("hardware counters need Linux perf events")
+{
+    for (int i = 0; i < event_count; i++)
+    {
+        fds[i] = -1;
+        group_index[i] = -1;
+    }
+}
+
+Perf_counters::~Perf_counters()
+{
+}
+
+bool Perf_counters::read(uint64_t values[event_count]) const
+{
+    for (int i = 0; i < event_count; i++)
+    {
+        values[i] = 0;
+    }
+    return false;
+}
+
+#endif
+
+unsigned int Perf_counters::get_events(void) const
+{
+    unsigned int events = 0;
+    for (int i = 0; i < event_count; i++)
+    {
+        if (-1 != fds[i]) events |= 1U << i;
+    }
+    return events;
+}
@@ -0,0 +1,47 @@
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+// Hardware event counters for the calling thread, in user space only, as
+// one Linux perf_event group so a single read gets them all. Whichever
+// events the machine can't count (or all of them, off Linux, in a VM
+// without a PMU, or with perf_event_paranoid too high) are left out, with
+// the reason in get_error().
+class Perf_counters
+{
+public:
+    // as ww2ogg_event
+    enum Event {cycles, instructions, branch_misses, cache_misses, event_count};
+
+    static const char * event_name(int event);
+
+private:
+    int fds[event_count];       // -1 for those not counted
+    int leader;                 // the first counted, -1 if none
+    int group_index[event_count];
+    int counted;                // in the group
+    string error;
+
+    // Intentionally undefined
+    Perf_counters& operator=(const Perf_counters& rhs);
+    Perf_counters(const Perf_counters& rhs);
+
+public:
+    Perf_counters(void);
+    ~Perf_counters();
+
+    // a bit per Event being counted
+    unsigned int get_events(void) const;
+
+    const string& get_error(void) const { return error; }
+
+    // totals so far (0 for those not counted), false if they couldn't be
+    // read
+    bool read(uint64_t values[event_count]) const;
+};
+
+#endif
@@ -0,0 +1,239 @@
+#define __STDC_CONSTANT_MACROS
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <memory>
+#include "setup_cache.h"
+#include "codebook.h"
+#include "hash.h"
+#include "input_buffer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define current_pid() getpid()
+#elif defined(_WIN32)
+#include <process.h>
+#define current_pid() _getpid()
+#else
+#define current_pid() 0
+#endif
+
+/* on disk, little endian:
+   "WWSETUP1", key size, key, bits read, bit count, bits (padded to bytes),
+   mode count (0 for none), mode bits, one byte per mode blockflag */
+
+static const char setup_magic[8] = {'W','W','S','E','T','U','P','1'};
+
+static void put_32(string& out, uint32_t v)
+{
+    unsigned char b[4];
+    write_32_le(b, v);
+    out.append(reinterpret_cast<char *>(b), 4);
+}
+
+// consume 4 bytes from pos, false if there aren't that many
+static bool get_32(const Input_buffer& in, long& pos, uint32_t& v)
+{
+    const unsigned char * p = in.get(pos, 4);
+    if (!p) return false;
+    v = read_32_le(p);
+    pos += 4;
+    return true;
+}
+
+Setup_cache::Setup_cache(const string& d) : dir(d), entries()
+#ifdef SETUP_CACHE_LOCK
+    , lock()
+#endif
+{
+#ifdef SETUP_CACHE_LOCK
+    pthread_mutex_init(&lock, NULL);
+#endif
+}
+
+Setup_cache::~Setup_cache()
+{
+    for (map<string, const Setup_header *>::iterator i = entries.begin(); i != entries.end(); ++i)
+    {
+        delete i->second;
+    }
+#ifdef SETUP_CACHE_LOCK
+    pthread_mutex_destroy(&lock);
+#endif
+}
+
+string Setup_cache::file_name(const string& key) const
+{
+    ostringstream name;
+    name << dir << "/" << hex << setw(16) << setfill('0') << hash_fnv1a(key.data(), key.size()) << ".setup";
+    return name.str();
+}
+
+const Setup_header * Setup_cache::add(const string& key, Setup_header * header)
+{
+    const Setup_header * kept = header;
+
+#ifdef SETUP_CACHE_LOCK
+    pthread_mutex_lock(&lock);
+#endif
+    map<string, const Setup_header *>::iterator i = entries.find(key);
+    if (i == entries.end())
+    {
+        entries[key] = header;
+    }
+    else
+    {
+        kept = i->second;
+    }
+#ifdef SETUP_CACHE_LOCK
+    pthread_mutex_unlock(&lock);
+#endif
+
+    if (kept != header) delete header;
+
+    return kept;
+}
+
+const Setup_header * Setup_cache::find(const string& key, unsigned long packet_size)
+{
+    const Setup_header * found = NULL;
+
+#ifdef SETUP_CACHE_LOCK
+    pthread_mutex_lock(&lock);
+#endif
+    map<string, const Setup_header *>::const_iterator i = entries.find(key);
+    if (i != entries.end()) found = i->second;
+#ifdef SETUP_CACHE_LOCK
+    pthread_mutex_unlock(&lock);
+#endif
+
+    if (!found && !dir.empty())
+    {
+        Setup_header * loaded = load(key, packet_size);
+        if (loaded) found = add(key, loaded);
+    }
+
+    return found;
+}
+
+const Setup_header * Setup_cache::insert(const string& key, Setup_header * header)
+{
+    const Setup_header * kept = add(key, header);
+
+    if (kept == header && !dir.empty()) save(key, *header);
+
+    return kept;
+}
+
+// a damaged entry is a miss, and is removed so a good one can be saved
+static Setup_header * discard(auto_ptr<Input_buffer>& in, const string& name)
+{
+    in.reset();
+    remove(name.c_str());
+    return NULL;
+}
+
+// anything missing or not for this key is just a miss, as is anything
+// that couldn't have come from translating a setup packet of packet_size
+// bytes; the file is parsed as mapped, with no copy but the one into the
+// header
+Setup_header * Setup_cache::load(const string& key, unsigned long packet_size) const
+{
+    const string name = file_name(key);
+
+    auto_ptr<Input_buffer> in;
+    try
+    {
+        in.reset(new Input_buffer(name));
+    }
+    catch (const File_open_error&)
+    {
+        return NULL;
+    }
+
+    long pos = sizeof(setup_magic);
+    const unsigned char * magic = in->get(0, pos);
+    if (!magic || memcmp(magic, setup_magic, pos)) return discard(in, name);
+
+    // another key with the same hash
+    uint32_t key_size;
+    if (!get_32(*in, pos, key_size)) return discard(in, name);
+    const unsigned char * stored_key = in->get(pos, key_size);
+    if (!stored_key) return discard(in, name);
+    if (key_size != key.size() || memcmp(stored_key, key.data(), key_size)) return NULL;
+    pos += key_size;
+
+    uint32_t bits_read, bit_count;
+    if (!get_32(*in, pos, bits_read) || !get_32(*in, pos, bit_count)) return discard(in, name);
+    if ((static_cast<unsigned long>(bits_read) + 7) / 8 > packet_size) return discard(in, name);
+
+    long byte_count = (static_cast<unsigned long>(bit_count) + 7) / 8;
+    const unsigned char * bits = in->get(pos, byte_count);
+    if (!bits) return discard(in, name);
+    pos += byte_count;
+
+    // Vorbis has 1 to 64 modes, none here for --full-setup
+    uint32_t mode_count, mode_bits;
+    if (!get_32(*in, pos, mode_count) || !get_32(*in, pos, mode_bits)) return discard(in, name);
+    if (mode_count > 64) return discard(in, name);
+    if (static_cast<int>(mode_bits) != (mode_count ? ilog(mode_count-1) : 0)) return discard(in, name);
+    if (in->get_size() - pos != static_cast<long>(mode_count)) return discard(in, name);
+    const unsigned char * modes = in->get_data() + pos;
+
+    Setup_header * header = new Setup_header;
+    header->bits.put_bytes(bits, bit_count / 8);
+    if (bit_count % 8) header->bits.put_bits(bits[bit_count / 8], bit_count % 8);
+    header->bits_read = bits_read;
+    for (uint32_t i = 0; i < mode_count; i++)
+    {
+        header->mode_blockflag.push_back(modes[i] != 0);
+    }
+    header->mode_bits = mode_bits;
+
+    return header;
+}
+
+// written to a temporary file and renamed into place, so other processes
+// never see half an entry; failing to save is no error
+void Setup_cache::save(const string& key, const Setup_header& header) const
+{
+    string out(setup_magic, sizeof(setup_magic));
+
+    put_32(out, key.size());
+    out.append(key);
+
+    vector<unsigned char> bits = header.bits.get_bytes();
+    put_32(out, header.bits_read);
+    put_32(out, header.bits.get_total_bits());
+    if (!bits.empty()) out.append(reinterpret_cast<const char *>(&bits[0]), bits.size());
+
+    put_32(out, header.mode_blockflag.size());
+    put_32(out, header.mode_bits);
+    for (size_t i = 0; i < header.mode_blockflag.size(); i++)
+    {
+        out.push_back(header.mode_blockflag[i] ? 1 : 0);
+    }
+
+    const string name = file_name(key);
+    ostringstream temp_name;
+    temp_name << name << ".tmp" << current_pid();
+
+    {
+        ofstream os(temp_name.str().c_str(), ios::binary);
+        if (!os) return;
+        os.write(out.data(), out.size());
+        if (!os)
+        {
+            os.close();
+            remove(temp_name.str().c_str());
+            return;
+        }
+    }
+
+    if (0 != rename(temp_name.str().c_str(), name.c_str()))
+    {
+        remove(temp_name.str().c_str());
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef _SETUP_CACHE_H
+#define _SETUP_CACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Bit_stream.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SETUP_CACHE_LOCK
+#include <pthread.h>
+#endif
+
+using namespace std;
+
+// a finished Vorbis setup packet (everything after the packet type and
+// "vorbis"), and what the audio packets need from it
+class Setup_header
+{
+public:
+    Bit_bufstream bits;
+    unsigned long bits_read;        // of the Wwise setup packet
+    vector<bool> mode_blockflag;    // empty for --full-setup
+    int mode_bits;
+
+    Setup_header(void) : bits(), bits_read(0), mode_blockflag(), mode_bits(0) {}
+};
+
+// Setup_headers by key (the raw setup packet and whatever else went into
+// translating it), kept in memory and, given a directory, on disk across
+// runs. Entries are never changed or removed once added, so they can be
+// used by any thread until the cache goes.
+class Setup_cache
+{
+    string dir;
+    map<string, const Setup_header *> entries;
+#ifdef SETUP_CACHE_LOCK
+    pthread_mutex_t lock;
+#endif
+
+    // Intentionally undefined
+    Setup_cache& operator=(const Setup_cache& rhs);
+    Setup_cache(const Setup_cache& rhs);
+
+    string file_name(const string& key) const;
+    Setup_header * load(const string& key, unsigned long packet_size) const;
+    void save(const string& key, const Setup_header& header) const;
+
+    // the entry kept under key, which may be an earlier one than header
+    const Setup_header * add(const string& key, Setup_header * header);
+
+public:
+    // dir empty for memory only
+    explicit Setup_cache(const string& d);
+    ~Setup_cache();
+
+    // NULL if not cached; packet_size is that of the Wwise setup packet
+    // in key, which an entry loaded from disk mustn't have read past
+    const Setup_header * find(const string& key, unsigned long packet_size);
+
+    // takes ownership of header, returns what to use from now on
+    const Setup_header * insert(const string& key, Setup_header * header);
+};
+
+#endif
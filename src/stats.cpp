@@ -0,0 +1,129 @@
+#include <ctime>
+#include <cstring>
+#include "stats.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#if defined(_POSIX_TIMERS) && defined(CLOCK_MONOTONIC)
+#define HAVE_MONOTONIC_CLOCK
+#endif
+#endif
+
+uint64_t monotonic_ns(void)
+{
+#ifdef HAVE_MONOTONIC_CLOCK
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+    return static_cast<uint64_t>(clock()) * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+const char * Conversion_stats::stage_name(int stage)
+{
+    static const char * const names[stage_count] = {
+        "riff", "codebooks", "setup", "audio", "checksum", "output"
+    };
+    return (stage >= 0 && stage < stage_count) ? names[stage] : "";
+}
+
+const char * Conversion_stats::counter_name(int counter)
+{
+    static const char * const names[counter_count] = {
+        "packets", "pages", "bytes_in", "bytes_out", "seeks", "bits_read", "bits_written"
+    };
+    return (counter >= 0 && counter < counter_count) ? names[counter] : "";
+}
+
+#ifdef WW2OGG_STATS
+
+Conversion_stats::Conversion_stats(void) : ns(), counts(), current(stage_count), since(0),
+    perf(NULL), perf_since(), events(), tracing(false), entered(), spans()
+{
+}
+
+Conversion_stats::Conversion_stats(const Conversion_stats& rhs) : ns(), counts(), current(rhs.current),
+    since(rhs.since), perf(rhs.perf), perf_since(), events(), tracing(rhs.tracing), entered(), spans(rhs.spans)
+{
+    copy_arrays(rhs);
+}
+
+Conversion_stats& Conversion_stats::operator=(const Conversion_stats& rhs)
+{
+    if (this == &rhs) return *this;
+
+    current = rhs.current;
+    since = rhs.since;
+    perf = rhs.perf;
+    tracing = rhs.tracing;
+    spans = rhs.spans;
+    copy_arrays(rhs);
+    return *this;
+}
+
+void Conversion_stats::copy_arrays(const Conversion_stats& rhs)
+{
+    memcpy(ns, rhs.ns, sizeof(ns));
+    memcpy(counts, rhs.counts, sizeof(counts));
+    memcpy(perf_since, rhs.perf_since, sizeof(perf_since));
+    memcpy(events, rhs.events, sizeof(events));
+    memcpy(entered, rhs.entered, sizeof(entered));
+}
+
+void Conversion_stats::set_perf(const Perf_counters * p)
+{
+    perf = p;
+    if (perf) perf->read(perf_since);
+}
+
+uint64_t Conversion_stats::charge(bool read_events)
+{
+    const uint64_t now = monotonic_ns();
+    if (current != stage_count) ns[current] += now - since;
+    since = now;
+
+    uint64_t values[Perf_counters::event_count];
+    if (read_events && perf && perf->read(values))
+    {
+        for (int i = 0; i < Perf_counters::event_count; i++)
+        {
+            if (current != stage_count) events[current][i] += values[i] - perf_since[i];
+            perf_since[i] = values[i];
+        }
+    }
+
+    return now;
+}
+
+int Conversion_stats::enter(Stage stage)
+{
+    const uint64_t now = charge(!per_page(stage));
+    if (tracing) entered[stage] = now;
+
+    const int outer = current;
+    current = stage;
+    return outer;
+}
+
+void Conversion_stats::leave(int outer)
+{
+    const uint64_t now = charge(!per_page(current));
+    if (tracing && !per_page(current))
+    {
+        Span span = {current, entered[current], now};
+        spans.push_back(span);
+    }
+
+    current = outer;
+}
+
+void Conversion_stats::add_counts(const Conversion_stats& part)
+{
+    for (int i = 0; i < counter_count; i++)
+    {
+        counts[i] += part.counts[i];
+    }
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <vector>
+#include <stdint.h>
+#include "perf_counters.h"
+
+// nanoseconds from some fixed point, never going back
+uint64_t monotonic_ns(void);
+
+// Time spent in each stage of a conversion and counts of what it did, for
+// --stats. Time is charged to one stage at a time: entering a stage
+// pauses the one it was entered from until it's left again. For
+// --profile, hardware events are charged the same way, but only read
+// going in and out of the stages that aren't per page, so those of
+// checksums and output go to the stage around them; for --trace, each
+// time a stage other than those is left it's kept as a span.
+//
+// Built without WW2OGG_STATS all of it is empty and inlined away.
+class Conversion_stats
+{
+public:
+    // as ww2ogg_stage and ww2ogg_counter
+    enum Stage {riff, codebooks, setup, audio, checksum, output, stage_count};
+    enum Counter {packets, pages, bytes_in, bytes_out, seeks, bits_read, bits_written, counter_count};
+
+    static const char * stage_name(int stage);
+    static const char * counter_name(int counter);
+
+    // as ww2ogg_span
+    struct Span
+    {
+        int stage;
+        uint64_t start_ns, end_ns;
+    };
+
+    // checksums and output happen once a page, too often to keep spans
+    // for or to read the counters around
+    static bool per_page(int stage) { return stage == checksum || stage == output; }
+
+#ifdef WW2OGG_STATS
+private:
+    uint64_t ns[stage_count];
+    uint64_t counts[counter_count];
+    int current;        // stage_count outside all of them
+    uint64_t since;
+
+    const Perf_counters * perf;
+    uint64_t perf_since[Perf_counters::event_count];
+    uint64_t events[stage_count][Perf_counters::event_count];
+
+    bool tracing;
+    uint64_t entered[stage_count];
+    std::vector<Span> spans;    // grown as needed, each thread its own
+
+    void copy_arrays(const Conversion_stats& rhs);
+
+    // charge the current stage with the time since it was last, and with
+    // the events if read_events, returning the time
+    uint64_t charge(bool read_events);
+
+public:
+    Conversion_stats(void);
+    Conversion_stats(const Conversion_stats& rhs);
+    Conversion_stats& operator=(const Conversion_stats& rhs);
+
+    // from now on also count events, with counters for this thread
+    void set_perf(const Perf_counters * p);
+
+    // from now on keep spans of the traced stages
+    void set_tracing(void) { tracing = true; }
+
+    // returns the stage being left, to give back to leave()
+    int enter(Stage stage);
+    void leave(int outer);
+
+    void add(Counter counter, uint64_t n) { counts[counter] += n; }
+
+    // the counts only, for a part done elsewhere whose time is already
+    // in one of our stages
+    void add_counts(const Conversion_stats& part);
+
+    uint64_t get_ns(int stage) const { return ns[stage]; }
+    uint64_t get_count(int counter) const { return counts[counter]; }
+    uint64_t get_events(int stage, int event) const { return events[stage][event]; }
+    unsigned int get_span_count(void) const { return spans.size(); }
+    Span get_span(unsigned int i) const { return spans[i]; }
+#else
+    void set_perf(const Perf_counters *) {}
+    void set_tracing(void) {}
+    int enter(Stage) { return 0; }
+    void leave(int) {}
+    void add(Counter, uint64_t) {}
+    void add_counts(const Conversion_stats&) {}
+    uint64_t get_ns(int) const { return 0; }
+    uint64_t get_count(int) const { return 0; }
+    uint64_t get_events(int, int) const { return 0; }
+    unsigned int get_span_count(void) const { return 0; }
+    Span get_span(unsigned int) const { Span none = {stage_count, 0, 0}; return none; }
+#endif
+};
+
+// a stage for the life of the object, with stats NULL for none
+class Stats_stage
+{
+#ifdef WW2OGG_STATS
+    Conversion_stats * stats;
+    int outer;
+#endif
+
+    // Intentionally undefined
+    Stats_stage& operator=(const Stats_stage& rhs);
+    Stats_stage(const Stats_stage& rhs);
+
+public:
+#ifdef WW2OGG_STATS
+    Stats_stage(Conversion_stats * s, Conversion_stats::Stage stage) : stats(s), outer(0)
+    {
+        if (stats) outer = stats->enter(stage);
+    }
+
+    ~Stats_stage()
+    {
+        if (stats) stats->leave(outer);
+    }
+#else
+    Stats_stage(Conversion_stats *, Conversion_stats::Stage) {}
+#endif
+};
+
+inline void stats_add(Conversion_stats * stats, Conversion_stats::Counter counter, uint64_t n)
+{
+#ifdef WW2OGG_STATS
+    if (stats) stats->add(counter, n);
+#else
+    (void)stats; (void)counter; (void)n;
+#endif
+}
+
+#endif
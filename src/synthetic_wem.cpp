@@ -0,0 +1,557 @@
+#define __STDC_CONSTANT_MACROS
+#include <sstream>
+#include <vector>
+#include "synthetic_wem.h"
+#include "Bit_stream.h"
+
+namespace {
+
+// xorshift, so a seed gives the same file everywhere
+class Random
+{
+    uint32_t state;
+
+public:
+    explicit Random(uint32_t seed) : state(seed ? seed : 1) {}
+
+    uint32_t next(void)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // 0 to n-1
+    uint32_t below(uint32_t n)
+    {
+        return n ? next() % n : 0;
+    }
+};
+
+// little or big endian fields
+class Chunk_writer
+{
+    ostringstream os;
+    bool big_endian;
+
+    // Intentionally undefined
+    Chunk_writer& operator=(const Chunk_writer& rhs);
+    Chunk_writer(const Chunk_writer& rhs);
+
+public:
+    explicit Chunk_writer(bool be) : os(), big_endian(be) {}
+
+    void put_8(unsigned int v)
+    {
+        os.put(static_cast<char>(v & 0xFF));
+    }
+
+    void put_16(unsigned int v)
+    {
+        if (big_endian) write_16_be(os, v);
+        else write_16_le(os, v);
+    }
+
+    void put_32(uint32_t v)
+    {
+        if (big_endian) write_32_be(os, v);
+        else write_32_le(os, v);
+    }
+
+    void put_tag(const char * tag)
+    {
+        os.write(tag, 4);
+    }
+
+    void put_zeros(unsigned int n)
+    {
+        for (unsigned int i = 0; i < n; i++) os.put(0);
+    }
+
+    void put(const string& s)
+    {
+        os << s;
+    }
+
+    void put(const Bit_bufstream& bits)
+    {
+        const vector<unsigned char> bytes = bits.get_bytes();
+        if (!bytes.empty()) os.write(reinterpret_cast<const char *>(&bytes[0]), bytes.size());
+    }
+
+    unsigned long size(void)
+    {
+        return static_cast<unsigned long>(os.tellp());
+    }
+
+    string str(void) const
+    {
+        return os.str();
+    }
+};
+
+int ilog(unsigned int v)
+{
+    int ret = 0;
+    while (v)
+    {
+        ret++;
+        v >>= 1;
+    }
+    return ret;
+}
+
+unsigned int maptype1_quantvals(unsigned int entries, unsigned int dimensions)
+{
+    int bits = ilog(entries);
+    unsigned int vals = entries >> ((bits-1)*(dimensions-1)/dimensions);
+
+    while (1)
+    {
+        unsigned long acc = 1;
+        unsigned long acc1 = 1;
+        for (unsigned int i = 0; i < dimensions; i++)
+        {
+            acc *= vals;
+            acc1 *= vals+1;
+        }
+        if (acc <= entries && acc1 > entries) return vals;
+        if (acc > entries) vals--;
+        else vals++;
+    }
+}
+
+// a Vorbis codebook, or one in Wwise's packed form
+void put_codebook(Bit_bufstream& b, Random& r, bool full)
+{
+    const unsigned int dimensions = 1 + r.below(4);
+    const unsigned int entries = 2 + r.below(60);
+    const unsigned int lookup_type = (r.below(3) == 0) ? 1 : 0;
+
+    if (full)
+    {
+        b.put_bits(0x564342, 24);
+        b.put_bits(dimensions, 16);
+        b.put_bits(entries, 24);
+    }
+    else
+    {
+        b.put_bits(dimensions, 4);
+        b.put_bits(entries, 14);
+    }
+
+    const bool ordered = (r.below(4) == 0);
+    b.put_bit(ordered);
+    if (ordered)
+    {
+        b.put_bits(r.below(32), 5);
+        for (unsigned int current_entry = 0; current_entry < entries; )
+        {
+            const unsigned int number_bits = ilog(entries - current_entry);
+            unsigned int number = 1 + r.below(entries - current_entry);
+            if (number >= (1U << number_bits)) number = (1U << number_bits) - 1;
+            b.put_bits(number, number_bits);
+            current_entry += number;
+        }
+    }
+    else
+    {
+        const unsigned int codeword_length_length = full ? 5 : 1 + r.below(5);
+        if (!full) b.put_bits(codeword_length_length, 3);
+
+        const bool sparse = (r.below(2) != 0);
+        b.put_bit(sparse);
+        for (unsigned int i = 0; i < entries; i++)
+        {
+            bool present = true;
+            if (sparse)
+            {
+                present = (r.below(2) != 0);
+                b.put_bit(present);
+            }
+            if (present) b.put_bits(r.below(1U << codeword_length_length), codeword_length_length);
+        }
+    }
+
+    b.put_bits(lookup_type, full ? 4 : 1);
+    if (1 == lookup_type)
+    {
+        b.put_bits(r.next(), 32);
+        b.put_bits(r.next(), 32);
+        const unsigned int value_length = r.below(16);
+        b.put_bits(value_length, 4);
+        b.put_bit(r.below(2) != 0);
+
+        const unsigned int quantvals = maptype1_quantvals(entries, dimensions);
+        for (unsigned int i = 0; i < quantvals; i++)
+        {
+            b.put_bits(r.next() & ((1U << (value_length+1)) - 1), value_length+1);
+        }
+    }
+}
+
+// Wwise's stripped setup; returns the number of modes, odd ones long
+unsigned int put_stripped_setup(Bit_bufstream& b, Random& r, unsigned int channels, bool inline_codebooks)
+{
+    const unsigned int codebook_count = 1 + r.below(12);
+    b.put_bits(codebook_count-1, 8);
+    for (unsigned int i = 0; i < codebook_count; i++)
+    {
+        if (inline_codebooks) put_codebook(b, r, false);
+        else b.put_bits(r.below(598), 10);
+    }
+
+    const unsigned int floor_count = 1 + r.below(2);
+    b.put_bits(floor_count-1, 6);
+    for (unsigned int i = 0; i < floor_count; i++)
+    {
+        const unsigned int partitions = 1 + r.below(4);
+        b.put_bits(partitions, 5);
+
+        vector<unsigned int> partition_class(partitions);
+        unsigned int maximum_class = 0;
+        for (unsigned int j = 0; j < partitions; j++)
+        {
+            partition_class[j] = r.below(3);
+            b.put_bits(partition_class[j], 4);
+            if (partition_class[j] > maximum_class) maximum_class = partition_class[j];
+        }
+
+        vector<unsigned int> class_dimensions(maximum_class+1);
+        for (unsigned int j = 0; j <= maximum_class; j++)
+        {
+            class_dimensions[j] = 1 + r.below(3);
+            b.put_bits(class_dimensions[j]-1, 3);
+            const unsigned int subclasses = r.below(3);
+            b.put_bits(subclasses, 2);
+            if (subclasses) b.put_bits(r.below(codebook_count), 8);
+            for (unsigned int k = 0; k < (1U << subclasses); k++) b.put_bits(r.below(codebook_count+1), 8);
+        }
+
+        b.put_bits(r.below(4), 2);
+        const unsigned int rangebits = 1 + r.below(10);
+        b.put_bits(rangebits, 4);
+        for (unsigned int j = 0; j < partitions; j++)
+        {
+            for (unsigned int k = 0; k < class_dimensions[partition_class[j]]; k++)
+            {
+                b.put_bits(r.below(1U << rangebits), rangebits);
+            }
+        }
+    }
+
+    const unsigned int residue_count = 1 + r.below(2);
+    b.put_bits(residue_count-1, 6);
+    for (unsigned int i = 0; i < residue_count; i++)
+    {
+        b.put_bits(r.below(3), 2);
+        b.put_bits(r.below(1000), 24);
+        b.put_bits(r.below(1000), 24);
+        b.put_bits(r.below(64), 24);
+        const unsigned int classifications = 1 + r.below(4);
+        b.put_bits(classifications-1, 6);
+        b.put_bits(r.below(codebook_count), 8);
+
+        vector<unsigned int> cascade(classifications);
+        for (unsigned int j = 0; j < classifications; j++)
+        {
+            const unsigned int low_bits = r.below(8);
+            unsigned int high_bits = 0;
+            const bool bitflag = (r.below(3) == 0);
+            b.put_bits(low_bits, 3);
+            b.put_bit(bitflag);
+            if (bitflag)
+            {
+                high_bits = r.below(32);
+                b.put_bits(high_bits, 5);
+            }
+            cascade[j] = high_bits * 8 + low_bits;
+        }
+        for (unsigned int j = 0; j < classifications; j++)
+        {
+            for (unsigned int k = 0; k < 8; k++)
+            {
+                if (cascade[j] & (1U << k)) b.put_bits(r.below(codebook_count), 8);
+            }
+        }
+    }
+
+    const unsigned int mapping_count = 1 + r.below(2);
+    b.put_bits(mapping_count-1, 6);
+    for (unsigned int i = 0; i < mapping_count; i++)
+    {
+        unsigned int submaps = 1;
+        const bool submaps_flag = (channels > 1 && r.below(2));
+        b.put_bit(submaps_flag);
+        if (submaps_flag)
+        {
+            submaps = 1 + r.below(2);
+            b.put_bits(submaps-1, 4);
+        }
+
+        const bool square_polar_flag = (channels > 1 && r.below(2));
+        b.put_bit(square_polar_flag);
+        if (square_polar_flag)
+        {
+            const unsigned int coupling_steps = 1 + r.below(2);
+            b.put_bits(coupling_steps-1, 8);
+            for (unsigned int j = 0; j < coupling_steps; j++)
+            {
+                const unsigned int magnitude = r.below(channels);
+                const unsigned int angle = (magnitude + 1 + r.below(channels-1)) % channels;
+                b.put_bits(magnitude, ilog(channels-1));
+                b.put_bits(angle, ilog(channels-1));
+            }
+        }
+
+        b.put_bits(0, 2);
+        if (submaps > 1)
+        {
+            for (unsigned int j = 0; j < channels; j++) b.put_bits(r.below(submaps), 4);
+        }
+        for (unsigned int j = 0; j < submaps; j++)
+        {
+            b.put_bits(0, 8);
+            b.put_bits(r.below(floor_count), 8);
+            b.put_bits(r.below(residue_count), 8);
+        }
+    }
+
+    const unsigned int mode_count = 1 + r.below(4);
+    b.put_bits(mode_count-1, 6);
+    for (unsigned int i = 0; i < mode_count; i++)
+    {
+        b.put_bit(i % 2 == 1);
+        b.put_bits(r.below(mapping_count), 8);
+    }
+
+    return mode_count;
+}
+
+// only the codebooks are real, the rest is whatever follows them
+void put_full_setup(Bit_bufstream& b, Random& r)
+{
+    const unsigned int codebook_count = 1 + r.below(6);
+    b.put_bits(codebook_count-1, 8);
+    for (unsigned int i = 0; i < codebook_count; i++) put_codebook(b, r, true);
+
+    const unsigned int rest = 8 + r.below(200);
+    for (unsigned int i = 0; i < rest; i++) b.put_bit(r.below(2) != 0);
+}
+
+void put_vorbis_packet_header(Bit_bufstream& b, unsigned int type)
+{
+    b.put_bits(type, 8);
+    const char vorbis[6] = {'v','o','r','b','i','s'};
+    for (int i = 0; i < 6; i++) b.put_bits(vorbis[i], 8);
+}
+
+}
+
+const char * Synthetic_wem::layout_name(Layout l)
+{
+    switch (l)
+    {
+        case vorb_28:           return "vorb 0x28";
+        case vorb_2A:           return "vorb 0x2A";
+        case vorb_2A_standard:  return "vorb 0x2A std";
+        case vorb_2C:           return "vorb 0x2C";
+        case vorb_32:           return "vorb 0x32";
+        case vorb_34:           return "vorb 0x34";
+        case fmt_42:            return "fmt 0x42";
+        default:                return "?";
+    }
+}
+
+string Synthetic_wem::generate(uint32_t seed, Audio * audio) const
+{
+    Random r(seed);
+
+    const bool triad = (vorb_28 == layout || vorb_2C == layout);
+    const bool no_granule = (vorb_2A == layout || vorb_2A_standard == layout || fmt_42 == layout);
+    const bool mod_packets = (vorb_2A == layout || fmt_42 == layout);
+    const unsigned int channels = 1 + r.below(6);
+
+    // data: the setup (or triad) and then the audio packets
+    Chunk_writer data(rifx);
+    unsigned int mode_count = 0;
+    if (triad)
+    {
+        Bit_bufstream identification;
+        put_vorbis_packet_header(identification, 1);
+        for (int i = 0; i < 23; i++) identification.put_bits(r.below(256), 8);
+
+        Bit_bufstream comment;
+        put_vorbis_packet_header(comment, 3);
+        const unsigned int comment_length = 10 + r.below(40);
+        for (unsigned int i = 0; i < comment_length; i++) comment.put_bits(r.below(256), 8);
+
+        Bit_bufstream setup_packet;
+        put_vorbis_packet_header(setup_packet, 5);
+        put_full_setup(setup_packet, r);
+
+        const Bit_bufstream * const headers[3] = {&identification, &comment, &setup_packet};
+        for (int i = 0; i < 3; i++)
+        {
+            data.put_32(headers[i]->get_bytes().size());
+            data.put_32(0);
+            data.put(*headers[i]);
+        }
+    }
+    else
+    {
+        Bit_bufstream setup_packet;
+        if (full_setup == setup) put_full_setup(setup_packet, r);
+        else mode_count = put_stripped_setup(setup_packet, r, channels, inline_codebooks == setup);
+
+        data.put_16(setup_packet.get_bytes().size());
+        if (!no_granule) data.put_32(0);
+        data.put(setup_packet);
+    }
+
+    if (audio) audio->long_block.clear();
+
+    const uint32_t first_audio_packet_offset = data.size();
+    uint32_t granule = 0;
+    for (unsigned int i = 0; i < packets; i++)
+    {
+        unsigned int size = 1 + r.below(max_packet_size);
+        if (r.below(50) == 0) size = 1;
+
+        string payload(size, 0);
+        for (unsigned int j = 0; j < size; j++) payload[j] = static_cast<char>(r.below(256));
+
+        // a mode number that's in the setup
+        if (mod_packets && mode_count > 0)
+        {
+            const unsigned int mode_bits = ilog(mode_count-1);
+            const unsigned int mode = r.below(mode_count);
+            payload[0] = static_cast<char>((static_cast<unsigned char>(payload[0]) & ~((1U << mode_bits) - 1)) |
+                    mode);
+            if (audio) audio->long_block.push_back(mode % 2 == 1);
+        }
+
+        granule += 64 + r.below(1024);
+        const uint32_t stored_granule = (r.below(40) == 0) ? UINT32_C(0xFFFFFFFF) : granule;
+
+        if (triad)
+        {
+            data.put_32(size);
+            data.put_32(stored_granule);
+        }
+        else
+        {
+            data.put_16(size);
+            if (!no_granule) data.put_32(stored_granule);
+        }
+        data.put(payload);
+    }
+
+    // vorb, sizes and offsets as the constructor reads them
+    unsigned int vorb_size = 0x2A;
+    if (vorb_28 == layout) vorb_size = 0x28;
+    else if (vorb_2C == layout) vorb_size = 0x2C;
+    else if (vorb_32 == layout) vorb_size = 0x32;
+    else if (vorb_34 == layout) vorb_size = 0x34;
+
+    const uint32_t samples = sample_count ? sample_count : granule + 100;
+    if (audio)
+    {
+        // as the vorb below has them
+        audio->blocksize[0] = 1U << 8;
+        audio->blocksize[1] = 1U << 11;
+        audio->sample_count = samples;
+    }
+
+    Chunk_writer vorb(rifx);
+    vorb.put_32(samples);
+    if (0x2A == vorb_size)
+    {
+        vorb.put_32(mod_packets ? 0xD9 : 0x4A);
+        vorb.put_zeros(8);
+        vorb.put_32(0);
+        vorb.put_32(first_audio_packet_offset);
+        vorb.put_zeros(0xC);
+        vorb.put_32(r.next());
+        vorb.put_8(8);
+        vorb.put_8(11);
+    }
+    else
+    {
+        vorb.put_zeros(0x14);
+        vorb.put_32(0);
+        vorb.put_32(first_audio_packet_offset);
+        if (vorb_size >= 0x32)
+        {
+            vorb.put_zeros(0xC);
+            vorb.put_32(r.next());
+            vorb.put_8(8);
+            vorb.put_8(11);
+        }
+        vorb.put_zeros(vorb_size - vorb.size());
+    }
+
+    unsigned int fmt_size = 0x42;
+    if (fmt_42 != layout)
+    {
+        fmt_size = (r.below(3) == 0) ? 0x28 : (r.below(2) ? 0x18 : 0x12);
+    }
+
+    Chunk_writer fmt(rifx);
+    fmt.put_16(0xFFFF);
+    fmt.put_16(channels);
+    fmt.put_32(44100);
+    fmt.put_32(16000 + r.below(20000));
+    fmt.put_16(0);
+    fmt.put_16(0);
+    fmt.put_16(fmt_size - 0x12);
+    if (fmt_size >= 0x18)
+    {
+        fmt.put_16(0);
+        fmt.put_32(3);
+    }
+    if (0x28 == fmt_size)
+    {
+        const unsigned char subtype[16] = {1,0,0,0, 0,0,0x10,0, 0x80,0,0,0xAA, 0,0x38,0x9b,0x71};
+        for (int i = 0; i < 16; i++) fmt.put_8(subtype[i]);
+    }
+    if (fmt_42 == layout) fmt.put(vorb.str());
+
+    Chunk_writer riff(rifx);
+    riff.put_tag("WAVE");
+    riff.put_tag("fmt ");
+    riff.put_32(fmt_size);
+    riff.put(fmt.str());
+
+    // sometimes a loop
+    if (r.below(3) == 0 && granule > 10)
+    {
+        riff.put_tag("smpl");
+        riff.put_32(0x3C);
+        riff.put_zeros(0x1C);
+        riff.put_32(1);
+        riff.put_zeros(0xC);
+        riff.put_32(1);
+        riff.put_32(granule / 2);
+        riff.put_zeros(8);
+    }
+
+    if (fmt_42 != layout)
+    {
+        riff.put_tag("vorb");
+        riff.put_32(vorb_size);
+        riff.put(vorb.str());
+    }
+
+    riff.put_tag("data");
+    riff.put_32(data.size());
+    riff.put(data.str());
+
+    Chunk_writer file(rifx);
+    file.put_tag(rifx ? "RIFX" : "RIFF");
+    file.put_32(riff.size());
+    file.put(riff.str());
+
+    return file.str();
+}
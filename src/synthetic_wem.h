@@ -0,0 +1,66 @@
+#ifndef _SYNTHETIC_WEM_H
+#define _SYNTHETIC_WEM_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// Made up Wwise Vorbis files, the same for the same seed, for timing and
+// checking the converter without a game's worth of real ones. The setup
+// headers are random but well formed, and reference the packed codebooks
+// by id (so they need the default packed_codebooks.bin); the audio
+// packets are random bytes of random sizes.
+class Synthetic_wem
+{
+public:
+    // the layouts the Wwise_RIFF_Vorbis constructor tells apart
+    enum Layout
+    {
+        vorb_28,            // 8 byte packet headers, header triad
+        vorb_2A,            // 2 byte packet headers, modified packets
+        vorb_2A_standard,   // 2 byte packet headers, standard packets
+        vorb_2C,            // as 0x28
+        vorb_32,            // 6 byte packet headers
+        vorb_34,            // as 0x32
+        fmt_42,             // no vorb, 0x2A's fields at the end of fmt
+        layout_count
+    };
+
+    // how the setup header is stored (with the header triad it's always
+    // whole, and this is ignored)
+    enum Setup
+    {
+        stripped,           // packed codebook ids
+        inline_codebooks,   // needs --inline-codebooks
+        full_setup          // needs --full-setup
+    };
+
+    // what the audio was made of, for checking the output
+    struct Audio
+    {
+        vector<bool> long_block;        // per packet, where they have modes
+        unsigned int blocksize[2];      // without the header triad
+        uint32_t sample_count;
+
+        Audio() : long_block(), sample_count(0) { blocksize[0] = blocksize[1] = 0; }
+    };
+
+    Layout layout;
+    Setup setup;
+    bool rifx;
+    unsigned int packets;
+    unsigned int max_packet_size;
+    uint32_t sample_count;      // 0 for a little past the last granule
+
+    explicit Synthetic_wem(Layout l) : layout(l), setup(stripped), rifx(false), packets(200), max_packet_size(400),
+        sample_count(0) {}
+
+    static const char * layout_name(Layout l);
+
+    // the whole file, and what its audio was made of if audio isn't NULL
+    string generate(uint32_t seed, Audio * audio = NULL) const;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include <deque>
+#include "work_stealing.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+unsigned int processor_count(void)
+{
+#if defined(HAVE_PTHREAD) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return n;
+#endif
+    return 1;
+}
+
+static void run_in_order(Work_items& items)
+{
+    for (size_t i = 0; i < items.count(); i++)
+    {
+        items.run(i, 0);
+        items.finish(i);
+    }
+}
+
+#ifdef HAVE_PTHREAD
+
+namespace {
+
+class Worker_deque
+{
+    pthread_mutex_t lock;
+    deque<size_t> items;
+
+    // Intentionally undefined
+    Worker_deque& operator=(const Worker_deque& rhs);
+    Worker_deque(const Worker_deque& rhs);
+
+public:
+    Worker_deque(void) : lock(), items() { pthread_mutex_init(&lock, NULL); }
+    ~Worker_deque() { pthread_mutex_destroy(&lock); }
+
+    void push(size_t i) { items.push_back(i); }
+
+    // the owner works from the front...
+    bool pop(size_t& i)
+    {
+        pthread_mutex_lock(&lock);
+        bool got = !items.empty();
+        if (got)
+        {
+            i = items.front();
+            items.pop_front();
+        }
+        pthread_mutex_unlock(&lock);
+        return got;
+    }
+
+    // ...and thieves from the back
+    bool steal(size_t& i)
+    {
+        pthread_mutex_lock(&lock);
+        bool got = !items.empty();
+        if (got)
+        {
+            i = items.back();
+            items.pop_back();
+        }
+        pthread_mutex_unlock(&lock);
+        return got;
+    }
+};
+
+class Pool
+{
+    Work_items& items;
+    vector<Worker_deque *> deques;
+
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+    vector<bool> done;
+
+    // Intentionally undefined
+    Pool& operator=(const Pool& rhs);
+    Pool(const Pool& rhs);
+
+public:
+    Pool(Work_items& w, const vector<size_t>& order, unsigned int threads)
+        : items(w), deques(threads), done_lock(), done_cond(), done(w.count(), false)
+    {
+        pthread_mutex_init(&done_lock, NULL);
+        pthread_cond_init(&done_cond, NULL);
+
+        for (unsigned int t = 0; t < threads; t++)
+        {
+            deques[t] = new Worker_deque;
+        }
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            deques[i % threads]->push(order[i]);
+        }
+    }
+
+    ~Pool()
+    {
+        for (size_t t = 0; t < deques.size(); t++)
+        {
+            delete deques[t];
+        }
+        pthread_cond_destroy(&done_cond);
+        pthread_mutex_destroy(&done_lock);
+    }
+
+    // nothing is added once we start, so empty everywhere means finished
+    bool take(unsigned int self, size_t& i)
+    {
+        if (deques[self]->pop(i)) return true;
+
+        for (size_t k = 1; k < deques.size(); k++)
+        {
+            if (deques[(self + k) % deques.size()]->steal(i)) return true;
+        }
+
+        return false;
+    }
+
+    void work(unsigned int self)
+    {
+        size_t i;
+        while (take(self, i))
+        {
+            items.run(i, self);
+
+            pthread_mutex_lock(&done_lock);
+            done[i] = true;
+            pthread_cond_broadcast(&done_cond);
+            pthread_mutex_unlock(&done_lock);
+        }
+    }
+
+    void wait_for(size_t i)
+    {
+        pthread_mutex_lock(&done_lock);
+        while (!done[i])
+        {
+            pthread_cond_wait(&done_cond, &done_lock);
+        }
+        pthread_mutex_unlock(&done_lock);
+    }
+};
+
+struct Worker_start
+{
+    Pool * pool;
+    unsigned int self;
+};
+
+extern "C" void * worker_main(void * arg)
+{
+    Worker_start * start = static_cast<Worker_start *>(arg);
+    start->pool->work(start->self);
+    return NULL;
+}
+
+}
+
+void run_work_stealing(Work_items& items, const vector<size_t>& order, unsigned int threads)
+{
+    if (threads > items.count()) threads = items.count();
+    if (threads <= 1)
+    {
+        run_in_order(items);
+        return;
+    }
+
+    Pool pool(items, order, threads);
+
+    vector<pthread_t> ids(threads);
+    vector<Worker_start> starts(threads);
+    unsigned int started = 0;
+    for (; started < threads; started++)
+    {
+        starts[started].pool = &pool;
+        starts[started].self = started;
+        if (0 != pthread_create(&ids[started], NULL, worker_main, &starts[started])) break;
+    }
+
+    // couldn't start any at all, do it here; with fewer than asked the
+    // others' deques just get stolen from
+    if (0 == started)
+    {
+        run_in_order(items);
+        return;
+    }
+
+    for (size_t i = 0; i < items.count(); i++)
+    {
+        pool.wait_for(i);
+        items.finish(i);
+    }
+
+    for (unsigned int t = 0; t < started; t++)
+    {
+        pthread_join(ids[t], NULL);
+    }
+}
+
+#else
+
+void run_work_stealing(Work_items& items, const vector<size_t>& order, unsigned int threads)
+{
+    (void)order;
+    (void)threads;
+    run_in_order(items);
+}
+
+#endif
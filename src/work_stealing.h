@@ -0,0 +1,34 @@
+#ifndef _WORK_STEALING_H
+#define _WORK_STEALING_H
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// a fixed set of independent items of work
+class Work_items
+{
+public:
+    virtual ~Work_items() {}
+
+    virtual size_t count(void) const = 0;
+
+    // do item i, on whichever thread takes it (worker, from 0, says
+    // which); must not throw
+    virtual void run(size_t i, unsigned int worker) = 0;
+
+    // item i is done; called on the caller's thread, in index order
+    virtual void finish(size_t i) = 0;
+};
+
+// Run every item on a pool of threads, each with its own deque, dealt
+// round-robin in the given order (best start with the largest). Idle
+// threads steal from the far end of the others' deques. With threads <= 1,
+// or no thread support, each item is run and finished in turn.
+void run_work_stealing(Work_items& items, const vector<size_t>& order, unsigned int threads);
+
+// online processors, at least 1
+unsigned int processor_count(void);
+
+#endif
@@ -2,35 +2,79 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
-#include "wwriff.h"
-#include "stdint.h"
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include "libww2ogg.h"
+#include "input_buffer.h"
+#include "work_stealing.h"
+#include "stats.h"
 #include "errors.h"
 
 using namespace std;
 
-class ww2ogg_options
+class ww2ogg_args
 {
-    string in_filename;
+    vector<string> in_filenames;
     string out_filename;
+    string out_dir;
+    string list_filename;
     string codebooks_filename;
+    string setup_cache_dir;
+    string stats_filename;
+    string trace_filename;
+    bool batch;
+    unsigned int threads;
     bool inline_codebooks;
     bool full_setup;
-    ForcePacketFormat force_packet_format;
+    int packet_format;
+    bool pack_pages;
+    bool recompute_granules;
+    bool profile;
 public:
-    ww2ogg_options(void) : in_filename(""),
-                           out_filename(""),
-                           codebooks_filename("packed_codebooks.bin"),
-                           inline_codebooks(false),
-                           full_setup(false),
-                           force_packet_format(kNoForcePacketFormat)
+    ww2ogg_args(void) : in_filenames(),
+                        out_filename(""),
+                        out_dir(""),
+                        list_filename(""),
+                        codebooks_filename(""),
+                        setup_cache_dir(""),
+                        stats_filename(""),
+                        trace_filename(""),
+                        batch(false),
+                        threads(1),
+                        inline_codebooks(false),
+                        full_setup(false),
+                        packet_format(WW2OGG_PACKET_FORMAT_AUTO),
+                        pack_pages(false),
+                        recompute_granules(false),
+                        profile(false)
       {}
     void parse_args(int argc, char **argv);
-    const string& get_in_filename(void) const {return in_filename;}
+    const vector<string>& get_in_filenames(void) const {return in_filenames;}
     const string& get_out_filename(void) const {return out_filename;}
+    const string& get_out_dir(void) const {return out_dir;}
+    const string& get_list_filename(void) const {return list_filename;}
     const string& get_codebooks_filename(void) const {return codebooks_filename;}
+    const string& get_setup_cache_dir(void) const {return setup_cache_dir;}
+    const string& get_stats_filename(void) const {return stats_filename;}
+    const string& get_trace_filename(void) const {return trace_filename;}
+    bool get_batch(void) const {return batch;}
+    unsigned int get_threads(void) const {return threads;}
     bool get_inline_codebooks(void) const {return inline_codebooks;}
     bool get_full_setup(void) const {return full_setup;}
-    ForcePacketFormat get_force_packet_format(void) const {return force_packet_format;}
+    int get_packet_format(void) const {return packet_format;}
+    bool get_pack_pages(void) const {return pack_pages;}
+    bool get_recompute_granules(void) const {return recompute_granules;}
+    bool get_profile(void) const {return profile;}
 };
 
 void usage(void)
@@ -38,14 +82,548 @@ void usage(void)
     cout << endl;
     cout << "usage: ww2ogg input.wav [-o output.ogg] [--inline-codebooks] [--full-setup]" << endl <<
             "                        [--mod-packets | --no-mod-packets]" << endl <<
-            "                        [--pcb packed_codebooks.bin]" << endl << endl;
+            "                        [--pack-pages] [--recompute-granules] [-j threads]" << endl <<
+            "                        [--pcb packed_codebooks.bin] [--setup-cache directory]" << endl <<
+            "                        [--stats stats.json] [--profile] [--trace trace.json]" << endl <<
+            "       ww2ogg --batch [input.wav | directory ...] [--list files.txt | --list -]" << endl <<
+            "                      [--out-dir directory] [-j threads]" << endl <<
+            "                      [other options as above]" << endl << endl;
 }
 
+// the output file is only created once the input has parsed
+class Output_file
+{
+    const string& filename;
+    ostream& log;
+    ofstream of;
+    bool open_failed;
+
+    // Intentionally undefined
+    Output_file& operator=(const Output_file& rhs);
+    Output_file(const Output_file& rhs);
+
+public:
+    Output_file(const string& name, ostream& l) : filename(name), log(l), of(), open_failed(false) {}
+
+    bool get_open_failed(void) const { return open_failed; }
+
+    void close(void) { if (of.is_open()) of.close(); }
+
+    static int info(void * ctx, const char * info)
+    {
+        Output_file * out = static_cast<Output_file *>(ctx);
+
+        out->log << info;
+        out->log << "Output: " << out->filename << endl;
+
+        out->of.open(out->filename.c_str(), ios::binary);
+        if (!out->of)
+        {
+            out->open_failed = true;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    static int sink(void * ctx, const void * data, size_t bytes)
+    {
+        Output_file * out = static_cast<Output_file *>(ctx);
+
+        out->of.write(static_cast<const char *>(data), bytes);
+        return out->of ? 0 : 1;
+    }
+};
+
+// input.wem -> input.ogg, in out_dir if there is one
+string output_name(const string& in_filename, const string& out_dir)
+{
+    size_t found = in_filename.find_last_of('.');
+
+    string out_filename = in_filename.substr(0, found);
+    out_filename.append(".ogg");
+
+    // TODO: should be case insensitive for Windows
+    if (out_filename == in_filename)
+    {
+        out_filename.append("_conv.ogg");
+    }
+
+    if (!out_dir.empty())
+    {
+        size_t slash = out_filename.find_last_of("/\\");
+        if (slash != string::npos) out_filename.erase(0, slash + 1);
+
+        out_filename = out_dir + "/" + out_filename;
+    }
+
+    return out_filename;
+}
+
+bool is_directory(const string& name)
+{
+    struct stat st;
+    return 0 == stat(name.c_str(), &st) && S_ISDIR(st.st_mode);
+}
+
+// .wem files directly in a directory, in name order
+void add_directory(const string& dir_name, vector<string>& inputs)
+{
+    DIR * dir = opendir(dir_name.c_str());
+    if (!dir) throw File_open_error(dir_name);
+
+    vector<string> names;
+    for (struct dirent * de = readdir(dir); de; de = readdir(dir))
+    {
+        string name = de->d_name;
+        if (name.size() <= 4) continue;
+
+        string ext = name.substr(name.size() - 4);
+        for (size_t i = 0; i < ext.size(); i++)
+        {
+            ext[i] = tolower(ext[i]);
+        }
+        if (ext != ".wem") continue;
+
+        string path = dir_name + "/" + name;
+        if (!is_directory(path)) names.push_back(path);
+    }
+    closedir(dir);
+
+    sort(names.begin(), names.end());
+    inputs.insert(inputs.end(), names.begin(), names.end());
+}
+
+// one name per line, "-" for stdin
+void add_list(const string& list_filename, vector<string>& inputs)
+{
+    ifstream list_file;
+    if (list_filename != "-")
+    {
+        list_file.open(list_filename.c_str());
+        if (!list_file) throw File_open_error(list_filename);
+    }
+    istream& is = (list_filename != "-") ? static_cast<istream&>(list_file) : cin;
+
+    string line;
+    while (getline(is, line))
+    {
+        if (!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+        if (!line.empty()) inputs.push_back(line);
+    }
+}
+
+// checksums and output, whose events --profile counts in the stage around
+// them
+bool per_page_stage(int stage)
+{
+    return WW2OGG_STAGE_CHECKSUM == stage || WW2OGG_STAGE_OUTPUT == stage;
+}
+
+// quoted, with what JSON needs escaped
+void put_json_string(ostream& os, const string& s)
+{
+    os << '"';
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        const unsigned char c = s[i];
+        if ('"' == c || '\\' == c) os << '\\' << c;
+        else if (c < 0x20) os << "\\u" << hex << setw(4) << setfill('0') << static_cast<unsigned int>(c) << dec << setfill(' ');
+        else os << c;
+    }
+    os << '"';
+}
+
+// --stats: each file's stats as it's finished, then the totals, as JSON;
+// --profile alone only needs the totals
+class Stats_report
+{
+    ofstream of;
+    bool json;
+    ww2ogg_stats total;
+    unsigned long files;
+    unsigned long converted;
+
+    // Intentionally undefined
+    Stats_report& operator=(const Stats_report& rhs);
+    Stats_report(const Stats_report& rhs);
+
+    void put_stats(const ww2ogg_stats& stats, double wall_seconds)
+    {
+        of << "\"seconds\": {";
+        for (int i = 0; i < WW2OGG_STAGE_COUNT; i++)
+        {
+            of << (i ? ", " : "") << '"' << ww2ogg_stage_name(i) << "\": " << stats.seconds[i];
+        }
+        if (wall_seconds >= 0) of << ", \"wall\": " << wall_seconds;
+        of << "}, \"counts\": {";
+        for (int i = 0; i < WW2OGG_COUNTER_COUNT; i++)
+        {
+            of << (i ? ", " : "") << '"' << ww2ogg_counter_name(i) << "\": " << stats.counts[i];
+        }
+        of << "}";
+
+        if (!stats.events_counted) return;
+
+        // none of their own for the per page stages
+        of << ", \"events\": {";
+        for (int i = 0; i < WW2OGG_STAGE_COUNT; i++)
+        {
+            if (per_page_stage(i)) continue;
+
+            of << (i ? ", " : "") << '"' << ww2ogg_stage_name(i) << "\": {";
+            bool first = true;
+            for (int j = 0; j < WW2OGG_EVENT_COUNT; j++)
+            {
+                if (!(stats.events_counted & (1U << j))) continue;
+
+                of << (first ? "" : ", ") << '"' << ww2ogg_event_name(j) << "\": " << stats.events[i][j];
+                first = false;
+            }
+            of << "}";
+        }
+        of << "}";
+    }
+
+public:
+    // filename empty for no JSON
+    explicit Stats_report(const string& filename) : of(), json(!filename.empty()), total(), files(0), converted(0)
+    {
+        if (!json) return;
+
+        of.open(filename.c_str());
+        if (!of) throw File_open_error(filename);
+
+        of << fixed << setprecision(9);
+        of << "{\"files\": [";
+    }
+
+    void add_file(const string& input, bool ok, const ww2ogg_stats& stats)
+    {
+        if (json)
+        {
+            of << (files ? ",\n  " : "\n  ") << "{\"input\": ";
+            put_json_string(of, input);
+            of << ", \"converted\": " << (ok ? "true" : "false") << ", ";
+            put_stats(stats, -1);
+            of << "}";
+        }
+
+        ww2ogg_stats_add(&total, &stats);
+        files++;
+        if (ok) converted++;
+    }
+
+    // codebooks loaded once for all the files count towards the total
+    void finish(double wall_seconds, double codebooks_seconds)
+    {
+        total.seconds[WW2OGG_STAGE_CODEBOOKS] += codebooks_seconds;
+
+        if (!json) return;
+
+        of << "\n],\n\"total\": {\"files\": " << files << ", \"converted\": " << converted << ", ";
+        put_stats(total, wall_seconds);
+        of << "}}" << endl;
+    }
+
+    bool get_failed(void) const { return json && !of; }
+
+    // --profile: the totals per stage, with whichever events were counted
+    void print_profile(ostream& os) const
+    {
+        os << "Profile:" << endl;
+        os << setw(10) << left << "stage" << right << setw(12) << "seconds";
+        for (int j = 0; j < WW2OGG_EVENT_COUNT; j++)
+        {
+            os << setw(15) << ww2ogg_event_name(j);
+            if (WW2OGG_EVENT_INSTRUCTIONS == j) os << setw(6) << "IPC";
+        }
+        os << endl;
+
+        const unsigned int ipc_events = (1U << WW2OGG_EVENT_CYCLES) | (1U << WW2OGG_EVENT_INSTRUCTIONS);
+        for (int i = 0; i < WW2OGG_STAGE_COUNT; i++)
+        {
+            os << setw(10) << left << ww2ogg_stage_name(i) << right <<
+                setw(12) << fixed << setprecision(6) << total.seconds[i];
+            for (int j = 0; j < WW2OGG_EVENT_COUNT; j++)
+            {
+                if ((total.events_counted & (1U << j)) && !per_page_stage(i)) os << setw(15) << total.events[i][j];
+                else os << setw(15) << "-";
+
+                if (WW2OGG_EVENT_INSTRUCTIONS != j) continue;
+
+                const uint64_t cycles = total.events[i][WW2OGG_EVENT_CYCLES];
+                if ((total.events_counted & ipc_events) == ipc_events && cycles && !per_page_stage(i))
+                {
+                    os << setw(6) << setprecision(2) << static_cast<double>(total.events[i][WW2OGG_EVENT_INSTRUCTIONS]) / cycles;
+                }
+                else os << setw(6) << "-";
+            }
+            os << endl;
+        }
+    }
+};
+
+// --trace: where and when one file was converted; read_ns and flush_ns
+// stay 0 if it failed before getting that far
+struct File_trace
+{
+    unsigned int worker;
+    long bytes;
+    uint64_t start_ns;
+    uint64_t read_ns;       // input read
+    uint64_t flush_ns;      // output written, to be closed
+    uint64_t end_ns;
+};
+
+// --trace: a Chrome trace event timeline (for chrome://tracing or
+// Perfetto), with a span per file on the thread that converted it and
+// spans for its stages inside, written as each file is finished
+class Trace_report
+{
+    ofstream of;
+    uint64_t origin_ns;
+    vector<bool> named;     // workers with a thread_name yet
+    bool first;
+
+    // Intentionally undefined
+    Trace_report& operator=(const Trace_report& rhs);
+    Trace_report(const Trace_report& rhs);
+
+    void put_event(const string& name, const char * cat, unsigned int worker, uint64_t start_ns, uint64_t end_ns)
+    {
+        of << (first ? "\n  " : ",\n  ") << "{\"name\": ";
+        put_json_string(of, name);
+        of << ", \"cat\": \"" << cat << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << worker <<
+            ", \"ts\": " << (start_ns - origin_ns) / 1e3 << ", \"dur\": " << (end_ns - start_ns) / 1e3;
+        first = false;
+    }
+
+public:
+    Trace_report(const string& filename, uint64_t origin) : of(filename.c_str()), origin_ns(origin), named(), first(true)
+    {
+        if (!of) throw File_open_error(filename);
+
+        of << fixed << setprecision(3);
+        of << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    }
+
+    void add_file(const string& input, bool ok, const File_trace& trace, const ww2ogg_stats& stats)
+    {
+        if (trace.worker >= named.size()) named.resize(trace.worker + 1, false);
+        if (!named[trace.worker])
+        {
+            of << (first ? "\n  " : ",\n  ") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " <<
+                trace.worker << ", \"args\": {\"name\": \"worker " << trace.worker << "\"}}";
+            first = false;
+            named[trace.worker] = true;
+        }
+
+        put_event(input, "file", trace.worker, trace.start_ns, trace.end_ns);
+        of << ", \"args\": {\"bytes\": " << trace.bytes << ", \"converted\": " << (ok ? "true" : "false") << "}}";
+
+        if (trace.read_ns)
+        {
+            put_event("read", "io", trace.worker, trace.start_ns, trace.read_ns);
+            of << "}";
+        }
+        for (unsigned int i = 0; i < stats.span_count; i++)
+        {
+            const ww2ogg_span& span = stats.spans[i];
+            put_event(ww2ogg_stage_name(span.stage), "stage", trace.worker, span.start_ns, span.end_ns);
+            of << "}";
+        }
+        if (stats.spans_dropped)
+        {
+            // an instant where the kept ones stop, so the gap is explained
+            const uint64_t at_ns = stats.span_count ? stats.spans[stats.span_count - 1].end_ns : trace.start_ns;
+            of << ",\n  {\"name\": \"spans dropped\", \"cat\": \"stage\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, " <<
+                "\"tid\": " << trace.worker << ", \"ts\": " << (at_ns - origin_ns) / 1e3 <<
+                ", \"args\": {\"count\": " << stats.spans_dropped << "}}";
+        }
+        if (trace.flush_ns)
+        {
+            put_event("flush", "io", trace.worker, trace.flush_ns, trace.end_ns);
+            of << "}";
+        }
+    }
+
+    void finish(void)
+    {
+        of << "\n]}" << endl;
+    }
+
+    bool get_failed(void) const { return !of; }
+};
+
+bool convert_file(const string& in_filename, const string& out_filename, const ww2ogg_options& base_options,
+        ww2ogg_stats * stats, File_trace * trace, ostream& log)
+{
+    log << "Input: " << in_filename << endl;
+
+    try
+    {
+        Input_buffer input(in_filename);
+        if (trace)
+        {
+            trace->read_ns = monotonic_ns();
+            trace->bytes = input.get_size();
+        }
+
+        Output_file out(out_filename, log);
+
+        ww2ogg_options options = base_options;
+        options.info = Output_file::info;
+        options.info_ctx = &out;
+        options.stats = stats;
+
+        char error[1024];
+        int result = ww2ogg_convert(input.get_data(), input.get_size(),
+                Output_file::sink, &out, &options, error, sizeof(error));
+
+        if (out.get_open_failed())
+        {
+            log << File_open_error(out_filename) << endl;
+            return false;
+        }
+
+        if (WW2OGG_OK != result)
+        {
+            log << error << endl;
+            return false;
+        }
+
+        if (trace) trace->flush_ns = monotonic_ns();
+        out.close();
+
+        log << "Done!" << endl << endl;
+    }
+    catch (const File_open_error& fe)
+    {
+        log << fe << endl;
+        return false;
+    }
+
+    return true;
+}
+
+// each file's messages are held until all those before it are printed,
+// so the log reads the same however many threads there are
+class Batch_conversion : public Work_items
+{
+    const vector<string>& inputs;
+    vector<string> outputs;
+    vector<size_t> clashes;     // another input with the same output, or npos
+    const ww2ogg_options& options;
+    vector<ostringstream *> logs;
+    vector<char> succeeded;  // not vector<bool>, workers set these concurrently
+    vector<string> failed;
+    Stats_report * report;
+    Trace_report * trace;
+    vector<ww2ogg_stats> stats;
+    vector<File_trace> traces;
+
+    // Intentionally undefined
+    Batch_conversion& operator=(const Batch_conversion& rhs);
+    Batch_conversion(const Batch_conversion& rhs);
+
+public:
+    Batch_conversion(const vector<string>& i, const string& d, const ww2ogg_options& o, Stats_report * r,
+            Trace_report * t)
+        : inputs(i), outputs(i.size()), clashes(i.size(), string::npos), options(o), logs(i.size(), NULL),
+          succeeded(i.size(), 0), failed(), report(r), trace(t), stats((r || t) ? i.size() : 0),
+          traces(t ? i.size() : 0)
+    {
+        // with --out-dir, the same name from two directories (or the same
+        // file twice) would be written by two workers at once, so none of
+        // those files are converted
+        map<string, size_t> first;
+        for (size_t j = 0; j < inputs.size(); j++)
+        {
+            outputs[j] = output_name(inputs[j], d);
+
+            map<string, size_t>::iterator found = first.find(outputs[j]);
+            if (found == first.end())
+            {
+                first[outputs[j]] = j;
+                continue;
+            }
+
+            clashes[j] = found->second;
+            if (string::npos == clashes[found->second]) clashes[found->second] = j;
+        }
+    }
+
+    ~Batch_conversion()
+    {
+        for (size_t i = 0; i < logs.size(); i++)
+        {
+            delete logs[i];
+        }
+    }
+
+    const vector<string>& get_failed(void) const { return failed; }
+
+    size_t count(void) const { return inputs.size(); }
+
+    void run(size_t i, unsigned int worker)
+    {
+        // each file's stats and trace are only touched by the worker
+        // converting it, until it's finished
+        File_trace * file_trace = trace ? &traces[i] : NULL;
+        if (file_trace)
+        {
+            file_trace->worker = worker;
+            file_trace->start_ns = monotonic_ns();
+        }
+
+        try
+        {
+            logs[i] = new ostringstream;
+            if (string::npos != clashes[i])
+            {
+                *logs[i] << "Input: " << inputs[i] << endl << "Output " << outputs[i] <<
+                    " would also be written for " << inputs[clashes[i]] << ", not converting" << endl << endl;
+            }
+            else if (convert_file(inputs[i], outputs[i], options,
+                        stats.empty() ? NULL : &stats[i], file_trace, *logs[i]))
+            {
+                succeeded[i] = true;
+            }
+            else
+            {
+                *logs[i] << endl;
+            }
+        }
+        catch (...)
+        {
+            if (logs[i]) *logs[i] << "Error converting " << inputs[i] << endl << endl;
+        }
+
+        if (file_trace) file_trace->end_ns = monotonic_ns();
+    }
+
+    void finish(size_t i)
+    {
+        if (logs[i])
+        {
+            cout << logs[i]->str() << flush;
+            delete logs[i];
+            logs[i] = NULL;
+        }
+
+        if (!succeeded[i]) failed.push_back(inputs[i]);
+
+        if (report) report->add_file(inputs[i], succeeded[i] != 0, stats[i]);
+        if (trace) trace->add_file(inputs[i], succeeded[i] != 0, traces[i], stats[i]);
+    }
+};
+
 int main(int argc, char **argv)
 {
-    cout << "Audiokinetic Wwise RIFF/RIFX Vorbis to Ogg Vorbis converter " VERSION " by hcs" << endl << endl;
+    cout << "Audiokinetic Wwise RIFF/RIFX Vorbis to Ogg Vorbis converter " << ww2ogg_version() << " by hcs" << endl << endl;
 
-    ww2ogg_options opt;
+    ww2ogg_args opt;
 
     try
     {
@@ -59,42 +637,207 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    try
+    ww2ogg_options options;
+    ww2ogg_default_options(&options);
+    // no --pcb means the built in codebooks
+    if (!opt.get_codebooks_filename().empty())
     {
-        cout << "Input: " << opt.get_in_filename() << endl;
-        Wwise_RIFF_Vorbis ww(opt.get_in_filename(),
-                opt.get_codebooks_filename(),
-                opt.get_inline_codebooks(),
-                opt.get_full_setup(),
-                opt.get_force_packet_format()
-                );
+        options.codebooks_filename = opt.get_codebooks_filename().c_str();
+    }
+    options.inline_codebooks = opt.get_inline_codebooks();
+    options.full_setup = opt.get_full_setup();
+    options.packet_format = opt.get_packet_format();
+    // about the page size libogg aims for
+    if (opt.get_pack_pages()) options.page_size = 4096;
+    options.recompute_granules = opt.get_recompute_granules();
 
-        ww.print_info();
-        cout << "Output: " << opt.get_out_filename() << endl;
+    if (opt.get_profile())
+    {
+        options.profile = 1;
 
-        ofstream of(opt.get_out_filename().c_str(), ios::binary);
-        if (!of) throw File_open_error(opt.get_out_filename());
+        char error[256];
+        const unsigned int events = ww2ogg_profile_events(error, sizeof(error));
+        if (0 == events)
+        {
+            cout << "Profile: no hardware counters (" << error << "), times only" << endl;
+        }
+        else if (events != (1U << WW2OGG_EVENT_COUNT) - 1)
+        {
+            cout << "Profile: only some hardware counters (" << error << ")" << endl;
+        }
+    }
+
+    const uint64_t start = monotonic_ns();
 
-        ww.generate_ogg(of);
-        cout << "Done!" << endl << endl;
+    auto_ptr<Stats_report> report;
+    auto_ptr<Trace_report> trace;
+    try
+    {
+        if (!opt.get_stats_filename().empty() || opt.get_profile())
+        {
+            report.reset(new Stats_report(opt.get_stats_filename()));
+        }
+        if (!opt.get_trace_filename().empty())
+        {
+            options.trace = 1;
+            trace.reset(new Trace_report(opt.get_trace_filename(), start));
+        }
     }
     catch (const File_open_error& fe)
     {
         cout << fe << endl;
         return 1;
     }
-    catch (const Parse_error& pe)
+
+    if (!opt.get_batch())
+    {
+        ww2ogg_setup_cache * setup_cache = NULL;
+        if (!opt.get_setup_cache_dir().empty())
+        {
+            setup_cache = ww2ogg_setup_cache_new(opt.get_setup_cache_dir().c_str());
+            options.setup_cache = setup_cache;
+        }
+
+        // a batch runs a file per thread instead
+        options.threads = opt.get_threads();
+
+        ww2ogg_stats stats = ww2ogg_stats();
+        File_trace file_trace = File_trace();
+        file_trace.start_ns = monotonic_ns();
+        bool ok = convert_file(opt.get_in_filenames()[0], opt.get_out_filename(), options,
+                (report.get() || trace.get()) ? &stats : NULL, trace.get() ? &file_trace : NULL, cout);
+        file_trace.end_ns = monotonic_ns();
+
+        ww2ogg_setup_cache_free(setup_cache);
+
+        if (trace.get())
+        {
+            trace->add_file(opt.get_in_filenames()[0], ok, file_trace, stats);
+            trace->finish();
+            if (trace->get_failed())
+            {
+                cout << "Error writing " << opt.get_trace_filename() << endl;
+                ok = false;
+            }
+        }
+
+        if (report.get())
+        {
+            report->add_file(opt.get_in_filenames()[0], ok, stats);
+            report->finish((monotonic_ns() - start) / 1e9, 0);
+            if (opt.get_profile()) report->print_profile(cout);
+            if (report->get_failed())
+            {
+                cout << "Error writing " << opt.get_stats_filename() << endl;
+                ok = false;
+            }
+        }
+
+        return ok ? 0 : 1;
+    }
+
+    vector<string> inputs;
+    try
+    {
+        const vector<string>& names = opt.get_in_filenames();
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            if (is_directory(names[i]))
+            {
+                add_directory(names[i], inputs);
+            }
+            else
+            {
+                inputs.push_back(names[i]);
+            }
+        }
+
+        if (!opt.get_list_filename().empty())
+        {
+            add_list(opt.get_list_filename(), inputs);
+        }
+    }
+    catch (const File_open_error& fe)
     {
-        cout << pe << endl;
+        cout << fe << endl;
         return 1;
     }
 
-    return 0;
+    // load the codebooks once for the whole batch; if that fails, leave
+    // each file that needs them to report it
+    ww2ogg_codebooks * codebooks = NULL;
+    const uint64_t codebooks_start = monotonic_ns();
+    if (!opt.get_inline_codebooks())
+    {
+        codebooks = ww2ogg_codebooks_load(options.codebooks_filename, NULL, 0);
+        options.codebooks = codebooks;
+    }
+    const double codebooks_seconds = (monotonic_ns() - codebooks_start) / 1e9;
+
+    // start the biggest files first so they don't finish last on their own
+    vector<pair<long, size_t> > by_size(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        struct stat st;
+        by_size[i].first = (0 == stat(inputs[i].c_str(), &st)) ? -static_cast<long>(st.st_size) : 0;
+        by_size[i].second = i;
+    }
+    stable_sort(by_size.begin(), by_size.end());
+
+    vector<size_t> order(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        order[i] = by_size[i].second;
+    }
+
+    // files from one game tend to share their setup packets
+    ww2ogg_setup_cache * setup_cache = ww2ogg_setup_cache_new(
+            opt.get_setup_cache_dir().empty() ? NULL : opt.get_setup_cache_dir().c_str());
+    options.setup_cache = setup_cache;
+
+    Batch_conversion batch(inputs, opt.get_out_dir(), options, report.get(), trace.get());
+    run_work_stealing(batch, order, opt.get_threads());
+
+    ww2ogg_setup_cache_free(setup_cache);
+    ww2ogg_codebooks_free(codebooks);
+
+    const vector<string>& failed = batch.get_failed();
+
+    cout << inputs.size() - failed.size() << " of " << inputs.size() << " files converted" << endl;
+    for (size_t i = 0; i < failed.size(); i++)
+    {
+        cout << "Failed: " << failed[i] << endl;
+    }
+
+    bool ok = failed.empty();
+
+    if (report.get())
+    {
+        report->finish((monotonic_ns() - start) / 1e9, codebooks_seconds);
+        if (opt.get_profile()) report->print_profile(cout);
+        if (report->get_failed())
+        {
+            cout << "Error writing " << opt.get_stats_filename() << endl;
+            ok = false;
+        }
+    }
+
+    if (trace.get())
+    {
+        trace->finish();
+        if (trace->get_failed())
+        {
+            cout << "Error writing " << opt.get_trace_filename() << endl;
+            ok = false;
+        }
+    }
+
+    return ok ? 0 : 1;
 }
 
-void ww2ogg_options::parse_args(int argc, char ** argv)
+void ww2ogg_args::parse_args(int argc, char ** argv)
 {
-    bool set_input = false, set_output = false;
+    bool set_output = false;
     for (int i = 1; i < argc; i++)
     {
         if (!strcmp(argv[i], "-o"))
@@ -113,6 +856,49 @@ void ww2ogg_options::parse_args(int argc, char ** argv)
             out_filename = argv[++i];
             set_output = true;
         }
+        else if (!strcmp(argv[i], "--batch"))
+        {
+            // many inputs, each converted as if on its own
+            batch = true;
+        }
+        else if (!strcmp(argv[i], "-j"))
+        {
+            // threads for the batch, or for the one file, 0 for one per
+            // processor
+            if (i+1 >= argc)
+            {
+                throw Argument_error("-j needs an option");
+            }
+
+            char * end;
+            long n = strtol(argv[++i], &end, 10);
+            if (*end || end == argv[i] || n < 0 || n > 1024)
+            {
+                throw Argument_error("-j needs a thread count");
+            }
+
+            threads = (0 == n) ? processor_count() : n;
+        }
+        else if (!strcmp(argv[i], "--out-dir"))
+        {
+            // batch output directory
+            if (i+1 >= argc)
+            {
+                throw Argument_error("--out-dir needs an option");
+            }
+
+            out_dir = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--list"))
+        {
+            // batch input names, one per line
+            if (i+1 >= argc)
+            {
+                throw Argument_error("--list needs an option");
+            }
+
+            list_filename = argv[++i];
+        }
         else if (!strcmp(argv[i], "--inline-codebooks"))
         {
             // switch for inline codebooks
@@ -126,20 +912,78 @@ void ww2ogg_options::parse_args(int argc, char ** argv)
         }
         else if (!strcmp(argv[i], "--mod-packets") || !strcmp(argv[i], "--no-mod-packets"))
         {
-            if (force_packet_format != kNoForcePacketFormat)
+            if (packet_format != WW2OGG_PACKET_FORMAT_AUTO)
             {
                 throw Argument_error("only one of --mod-packets or --no-mod-packets is allowed");
             }
 
             if (!strcmp(argv[i], "--mod-packets"))
             {
-              force_packet_format = kForceModPackets;
+              packet_format = WW2OGG_PACKET_FORMAT_MOD;
             }
             else
             {
-              force_packet_format = kForceNoModPackets;
+              packet_format = WW2OGG_PACKET_FORMAT_STANDARD;
             }
         }
+        else if (!strcmp(argv[i], "--pack-pages"))
+        {
+            // several audio packets per page, as revorb would
+            pack_pages = true;
+        }
+        else if (!strcmp(argv[i], "--recompute-granules"))
+        {
+            // true granules from the block sizes, as revorb would
+            recompute_granules = true;
+        }
+        else if (!strcmp(argv[i], "--setup-cache"))
+        {
+            // keep translated setup headers here across runs
+            if (i+1 >= argc)
+            {
+                throw Argument_error("--setup-cache needs an option");
+            }
+
+            setup_cache_dir = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--stats"))
+        {
+            // time per stage and counts, as JSON
+            if (i+1 >= argc)
+            {
+                throw Argument_error("--stats needs an option");
+            }
+            if (!ww2ogg_stats_enabled())
+            {
+                throw Argument_error("--stats isn't in this build (made with STATS=0)");
+            }
+
+            stats_filename = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--trace"))
+        {
+            // a timeline of each file and its stages, as a Chrome trace
+            if (i+1 >= argc)
+            {
+                throw Argument_error("--trace needs an option");
+            }
+            if (!ww2ogg_stats_enabled())
+            {
+                throw Argument_error("--trace isn't in this build (made with STATS=0)");
+            }
+
+            trace_filename = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--profile"))
+        {
+            // hardware counters per stage, where there are any
+            if (!ww2ogg_stats_enabled())
+            {
+                throw Argument_error("--profile isn't in this build (made with STATS=0)");
+            }
+
+            profile = true;
+        }
         else if (!strcmp(argv[i], "--pcb"))
         {
             // override default packed codebooks file
@@ -153,32 +997,42 @@ void ww2ogg_options::parse_args(int argc, char ** argv)
         else
         {
             // assume anything else is an input file name
-            if (set_input)
-            {
-                throw Argument_error("only one input file at a time");
-            }
+            in_filenames.push_back(argv[i]);
+        }
+    }
 
-            in_filename = argv[i];
-            set_input = true;
+    if (batch)
+    {
+        if (set_output)
+        {
+            throw Argument_error("-o can't be used with --batch, use --out-dir");
+        }
+
+        if (in_filenames.empty() && list_filename.empty())
+        {
+            throw Argument_error("no inputs given for --batch");
         }
+
+        return;
     }
 
-    if (!set_input)
+    if (!out_dir.empty() || !list_filename.empty())
     {
-        throw Argument_error("input name not specified");
+        throw Argument_error("--out-dir and --list need --batch");
     }
 
-    if (!set_output)
+    if (in_filenames.size() > 1)
     {
-        size_t found = in_filename.find_last_of('.');
+        throw Argument_error("only one input file at a time");
+    }
 
-        out_filename = in_filename.substr(0, found);
-        out_filename.append(".ogg");
+    if (in_filenames.empty())
+    {
+        throw Argument_error("input name not specified");
+    }
 
-        // TODO: should be case insensitive for Windows
-        if (out_filename == in_filename)
-        {
-            out_filename.append("_conv.ogg");
-        }
+    if (!set_output)
+    {
+        out_filename = output_name(in_filenames[0], "");
     }
 }
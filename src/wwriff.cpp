@@ -1,11 +1,17 @@
 #define __STDC_CONSTANT_MACROS
 #include <iostream>
 #include <cstring>
+#include <memory>
+#include <vector>
+#include <sstream>
+#include <new>
 #include "stdint.h"
 #include "errors.h"
 #include "wwriff.h"
 #include "Bit_stream.h"
 #include "codebook.h"
+#include "setup_cache.h"
+#include "work_stealing.h"
 
 using namespace std;
 
@@ -17,23 +23,24 @@ class Packet
     uint32_t _absolute_granule;
     bool _no_granule;
 public:
-    Packet(ifstream& i, long o, bool little_endian, bool no_granule = false) : _offset(o), _size(-1), _absolute_granule(0), _no_granule(no_granule) {
-        i.seekg(_offset);
+    Packet(const Input_buffer& i, long o, bool little_endian, bool no_granule = false) : _offset(o), _size(-1), _absolute_granule(0), _no_granule(no_granule) {
+        const unsigned char * h = i.get(_offset, header_size());
+        if (!h) throw Parse_error_str("packet header truncated");
 
         if (little_endian)
         {
-            _size = read_16_le(i);
+            _size = read_16_le(h);
             if (!_no_granule)
             {
-                _absolute_granule = read_32_le(i);
+                _absolute_granule = read_32_le(h+2);
             }
         }
         else
         {
-            _size = read_16_be(i);
+            _size = read_16_be(h);
             if (!_no_granule)
             {
-                _absolute_granule = read_32_be(i);
+                _absolute_granule = read_32_be(h+2);
             }
         }
     }
@@ -52,18 +59,19 @@ class Packet_8
     uint32_t _size;
     uint32_t _absolute_granule;
 public:
-    Packet_8(ifstream& i, long o, bool little_endian) : _offset(o), _size(-1), _absolute_granule(0) {
-        i.seekg(_offset);
+    Packet_8(const Input_buffer& i, long o, bool little_endian) : _offset(o), _size(-1), _absolute_granule(0) {
+        const unsigned char * h = i.get(_offset, header_size());
+        if (!h) throw Parse_error_str("packet header truncated");
 
         if (little_endian)
         {
-            _size = read_32_le(i);
-            _absolute_granule = read_32_le(i);
+            _size = read_32_le(h);
+            _absolute_granule = read_32_le(h+4);
         }
         else
         {
-            _size = read_32_be(i);
-            _absolute_granule = read_32_be(i);
+            _size = read_32_be(h);
+            _absolute_granule = read_32_be(h+4);
         }
     }
 
@@ -74,6 +82,129 @@ public:
     long next_offset(void) { return _offset + header_size() + _size; }
 };
 
+// the audio packets, gathered in one pass over their headers so the
+// conversion needs no seeking; mode and blockflag are only filled in for
+// modified packets
+class Packet_index
+{
+    // Intentionally undefined
+    Packet_index& operator=(const Packet_index& rhs);
+    Packet_index(const Packet_index& rhs);
+
+public:
+    enum { no_mode = 0xFF };    // first byte missing
+
+    vector<long> payload;
+    vector<uint32_t> size;
+    vector<uint32_t> granule;
+    vector<unsigned char> mode;
+    vector<unsigned char> blockflag;
+
+    long end_offset;        // just past the last packet
+    const char * stop;      // why the headers ran out early, NULL if they didn't
+
+    Packet_index(void) : payload(), size(), granule(), mode(), blockflag(), end_offset(0), stop(NULL) {}
+};
+
+// chunks of a file's audio packets, each converted on a stream of its own
+// and its pages written out in order; the first error stops the output
+// after what its chunk got out, just as on a single stream
+class Audio_chunks : public Work_items
+{
+    enum {no_error, parse_error, out_of_memory};
+
+    struct Chunk
+    {
+        string pages;
+        int error;
+        string message;
+        Conversion_stats stats;     // counts only, the time is in audio
+
+        Chunk(void) : pages(), error(no_error), message(), stats() {}
+    };
+
+    const Wwise_RIFF_Vorbis& ww;
+    const Packet_index& index;
+    ostream& of;
+    bool have_mode_blockflag;
+    int mode_bits;
+    uint32_t first_seqno;
+    size_t chunk_packets;
+    Conversion_stats * stats;
+
+    vector<Chunk> chunks;
+    size_t failed;
+
+    // Intentionally undefined
+    Audio_chunks& operator=(const Audio_chunks& rhs);
+    Audio_chunks(const Audio_chunks& rhs);
+
+public:
+    Audio_chunks(const Wwise_RIFF_Vorbis& w, const Packet_index& i, ostream& o,
+            bool have_modes, int bits, uint32_t seqno, size_t packets, Conversion_stats * s)
+        : ww(w), index(i), of(o), have_mode_blockflag(have_modes), mode_bits(bits), first_seqno(seqno),
+          chunk_packets(packets), stats(s), chunks((i.payload.size() + packets - 1) / packets), failed(chunks.size())
+    {}
+
+    size_t count(void) const { return chunks.size(); }
+
+    void run(size_t i, unsigned int)
+    {
+        Chunk& chunk = chunks[i];
+        const size_t begin = i * chunk_packets;
+        const size_t end = (begin + chunk_packets < index.payload.size()) ? begin + chunk_packets : index.payload.size();
+
+        try
+        {
+            ostringstream out;
+            {
+                Conversion_stats * chunk_stats = stats ? &chunk.stats : NULL;
+                Bit_oggstream os(out, 0, chunk_stats);
+                os.continue_stream(first_seqno + begin);
+
+                try
+                {
+                    ww.write_audio_packets(os, index, begin, end, have_mode_blockflag, mode_bits, chunk_stats);
+                }
+                catch (const Parse_error& pe)
+                {
+                    ostringstream message;
+                    pe.print_self(message);
+                    chunk.error = parse_error;
+                    chunk.message = message.str();
+                }
+            }
+            chunk.pages = out.str();
+        }
+        catch (const bad_alloc&)
+        {
+            chunk.error = out_of_memory;
+        }
+    }
+
+    void finish(size_t i)
+    {
+        if (failed < i) return;
+
+        {
+            Stats_stage stage(stats, Conversion_stats::output);
+            of.write(chunks[i].pages.data(), chunks[i].pages.size());
+        }
+        string().swap(chunks[i].pages);
+        if (stats) stats->add_counts(chunks[i].stats);
+
+        if (no_error != chunks[i].error) failed = i;
+    }
+
+    // rethrow the first error, if there was one
+    void check(void) const
+    {
+        if (failed == chunks.size()) return;
+        if (out_of_memory == chunks[failed].error) throw bad_alloc();
+        throw Parse_error_str(chunks[failed].message);
+    }
+};
+
 class Vorbis_packet_header
 {
     uint8_t type;
@@ -100,16 +231,20 @@ public:
 const char Vorbis_packet_header::vorbis_str[6] = {'v','o','r','b','i','s'};
 
 Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
-    const string& name,
+    const Input_buffer& input,
     const string& codebooks_name,
+    const codebook_library * codebooks,
+    Setup_cache * setup_cache,
+    Conversion_stats * stats,
     bool inline_codebooks,
     bool full_setup,
     ForcePacketFormat force_packet_format
     )
   :
-    _file_name(name),
     _codebooks_name(codebooks_name),
-    _infile(name.c_str(), ios::binary),
+    _codebooks(codebooks),
+    _setup_cache(setup_cache),
+    _input(input),
     _file_size(-1),
     _little_endian(true),
     _riff_size(-1),
@@ -147,19 +282,20 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
     _no_granule(false),
     _mod_packets(false),
     _read_16(NULL),
-    _read_32(NULL)
+    _read_32(NULL),
+    _stats(stats)
 {
-    if (!_infile) throw File_open_error(name);
+    Stats_stage stage(_stats, Conversion_stats::riff);
 
-    _infile.seekg(0, ios::end);
-    _file_size = _infile.tellg();
+    _file_size = _input.get_size();
+    stats_add(_stats, Conversion_stats::bytes_in, _file_size);
+
+    Input_cursor in(_input, 0);
 
 
     // check RIFF header
     {
-        unsigned char riff_head[4], wave_head[4];
-        _infile.seekg(0, ios::beg);
-        _infile.read(reinterpret_cast<char *>(riff_head), 4);
+        const unsigned char * riff_head = in.read(4);
 
         if (memcmp(&riff_head[0],"RIFX",4))
         {
@@ -188,11 +324,11 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
             _read_32 = read_32_be;
         }
 
-        _riff_size = _read_32(_infile) + 8;
+        _riff_size = _read_32(in.read(4)) + 8;
 
         if (_riff_size > _file_size) throw Parse_error_str("RIFF truncated");
 
-        _infile.read(reinterpret_cast<char *>(wave_head), 4);
+        const unsigned char * wave_head = in.read(4);
         if (memcmp(&wave_head[0],"WAVE",4)) throw Parse_error_str("missing WAVE");
     }
 
@@ -200,15 +336,14 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
     long chunk_offset = 12;
     while (chunk_offset < _riff_size)
     {
-        _infile.seekg(chunk_offset, ios::beg);
+        in.seek(chunk_offset);
 
         if (chunk_offset + 8 > _riff_size) throw Parse_error_str("chunk header truncated");
 
-        char chunk_type[4];
-        _infile.read(chunk_type, 4);
+        const unsigned char * chunk_type = in.read(4);
         uint32_t chunk_size;
         
-        chunk_size = _read_32(_infile);
+        chunk_size = _read_32(in.read(4));
 
         if (!memcmp(chunk_type,"fmt ",4))
         {
@@ -260,28 +395,27 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
         _vorb_offset = _fmt_offset + 0x18;
     }
 
-    _infile.seekg(_fmt_offset, ios::beg);
-    if (UINT16_C(0xFFFF) != _read_16(_infile)) throw Parse_error_str("bad codec id");
-    _channels = _read_16(_infile);
-    _sample_rate = _read_32(_infile);
-    _avg_bytes_per_second = _read_32(_infile);
-    if (0U != _read_16(_infile)) throw Parse_error_str("bad block align");
-    if (0U != _read_16(_infile)) throw Parse_error_str("expected 0 bps");
-    if (_fmt_size-0x12 != _read_16(_infile)) throw Parse_error_str("bad extra fmt length");
+    in.seek(_fmt_offset);
+    if (UINT16_C(0xFFFF) != _read_16(in.read(2))) throw Parse_error_str("bad codec id");
+    _channels = _read_16(in.read(2));
+    _sample_rate = _read_32(in.read(4));
+    _avg_bytes_per_second = _read_32(in.read(4));
+    if (0U != _read_16(in.read(2))) throw Parse_error_str("bad block align");
+    if (0U != _read_16(in.read(2))) throw Parse_error_str("expected 0 bps");
+    if (_fmt_size-0x12 != _read_16(in.read(2))) throw Parse_error_str("bad extra fmt length");
 
     if (_fmt_size-0x12 >= 2) {
       // read extra fmt
-      _ext_unk = _read_16(_infile);
+      _ext_unk = _read_16(in.read(2));
       if (_fmt_size-0x12 >= 6) {
-        _subtype = _read_32(_infile);
+        _subtype = _read_32(in.read(4));
       }
     }
 
     if (_fmt_size == 0x28)
     {
-        char whoknowsbuf[16];
         const unsigned char whoknowsbuf_check[16] = {1,0,0,0, 0,0,0x10,0, 0x80,0,0,0xAA, 0,0x38,0x9b,0x71};
-        _infile.read(whoknowsbuf, 16);
+        const unsigned char * whoknowsbuf = in.read(16);
         if (memcmp(whoknowsbuf, whoknowsbuf_check, 16)) throw Parse_error_str("expected signature in extra fmt?");
     }
 
@@ -291,9 +425,9 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
 #if 0
         if (0x1c != _cue_size) throw Parse_error_str("bad cue size");
 #endif
-        _infile.seekg(_cue_offset);
+        in.seek(_cue_offset);
 
-        _cue_count = _read_32(_infile);
+        _cue_count = _read_32(in.read(4));
     }
     
     // read LIST
@@ -301,10 +435,9 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
     {
 #if 0
         if ( 4 != _LIST_size ) throw Parse_error_str("bad LIST size");
-        char adtlbuf[4];
         const char adtlbuf_check[4] = {'a','d','t','l'};
-        _infile.seekg(_LIST_offset);
-        _infile.read(adtlbuf, 4);
+        in.seek(_LIST_offset);
+        const unsigned char * adtlbuf = in.read(4);
         if (memcmp(adtlbuf, adtlbuf_check, 4)) throw Parse_error_str("expected only adtl in LIST");
 #endif
     }
@@ -312,14 +445,14 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
     // read smpl
     if (-1 != _smpl_offset)
     {
-        _infile.seekg(_smpl_offset+0x1C);
-        _loop_count = _read_32(_infile);
+        in.seek(_smpl_offset+0x1C);
+        _loop_count = _read_32(in.read(4));
 
         if (1 != _loop_count) throw Parse_error_str("expected one loop");
 
-        _infile.seekg(_smpl_offset+0x2c);
-        _loop_start = _read_32(_infile);
-        _loop_end = _read_32(_infile);
+        in.seek(_smpl_offset+0x2c);
+        _loop_start = _read_32(in.read(4));
+        _loop_end = _read_32(in.read(4));
     }
 
     // read vorb
@@ -331,7 +464,7 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
         case 0x2C:
         case 0x32:
         case 0x34:
-            _infile.seekg(_vorb_offset+0x00, ios::beg);
+            in.seek(_vorb_offset+0x00);
             break;
 
         default:
@@ -339,7 +472,7 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
             break;
     }
 
-    _sample_count = _read_32(_infile);
+    _sample_count = _read_32(in.read(4));
 
     switch (_vorb_size)
     {
@@ -348,8 +481,8 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
         {
             _no_granule = true;
 
-            _infile.seekg(_vorb_offset + 0x4, ios::beg);
-            uint32_t mod_signal = _read_32(_infile);
+            in.seek(_vorb_offset + 0x4);
+            uint32_t mod_signal = _read_32(in.read(4));
 
             // set
             // D9     11011001
@@ -369,12 +502,12 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
             {
                 _mod_packets = true;
             }
-            _infile.seekg(_vorb_offset + 0x10, ios::beg);
+            in.seek(_vorb_offset + 0x10);
             break;
         }
 
         default:
-            _infile.seekg(_vorb_offset + 0x18, ios::beg);
+            in.seek(_vorb_offset + 0x18);
             break;
     }
 
@@ -387,19 +520,19 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
         _mod_packets = true;
     }
 
-    _setup_packet_offset = _read_32(_infile);
-    _first_audio_packet_offset = _read_32(_infile);
+    _setup_packet_offset = _read_32(in.read(4));
+    _first_audio_packet_offset = _read_32(in.read(4));
 
     switch (_vorb_size)
     {
         case -1:
         case 0x2A:
-            _infile.seekg(_vorb_offset + 0x24, ios::beg);
+            in.seek(_vorb_offset + 0x24);
             break;
 
         case 0x32:
         case 0x34:
-            _infile.seekg(_vorb_offset + 0x2C, ios::beg);
+            in.seek(_vorb_offset + 0x2C);
             break;
     } 
 
@@ -416,9 +549,9 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
         case 0x2A:
         case 0x32:
         case 0x34:
-            _uid = _read_32(_infile);
-            _blocksize_0_pow = _infile.get();
-            _blocksize_1_pow = _infile.get();
+            _uid = _read_32(in.read(4));
+            _blocksize_0_pow = *in.read(1);
+            _blocksize_1_pow = *in.read(1);
             break;
     }
 
@@ -453,84 +586,86 @@ Wwise_RIFF_Vorbis::Wwise_RIFF_Vorbis(
             //throw Parse_error_str("unknown subtype");
             break;
     }
+
+    stats_add(_stats, Conversion_stats::seeks, in.get_seeks());
 }
 
-void Wwise_RIFF_Vorbis::print_info(void)
+void Wwise_RIFF_Vorbis::print_info(ostream& os)
 {
     if (_little_endian)
     {
-        cout << "RIFF WAVE";
+        os << "RIFF WAVE";
     }
     else
     {
-        cout << "RIFX WAVE";
+        os << "RIFX WAVE";
     }
-    cout << " " << _channels << " channel";
-    if (_channels != 1) cout << "s";
-    cout << " " << _sample_rate << " Hz " << _avg_bytes_per_second*8 << " bps" << endl;
-    cout << _sample_count << " samples" << endl;
+    os << " " << _channels << " channel";
+    if (_channels != 1) os << "s";
+    os << " " << _sample_rate << " Hz " << _avg_bytes_per_second*8 << " bps" << endl;
+    os << _sample_count << " samples" << endl;
 
     if (0 != _loop_count)
     {
-        cout << "loop from " << _loop_start << " to " << _loop_end << endl;
+        os << "loop from " << _loop_start << " to " << _loop_end << endl;
     }
 
     if (_old_packet_headers)
     {
-        cout << "- 8 byte (old) packet headers" << endl;
+        os << "- 8 byte (old) packet headers" << endl;
     }
     else if (_no_granule)
     {
-        cout << "- 2 byte packet headers, no granule" << endl;
+        os << "- 2 byte packet headers, no granule" << endl;
     }
     else
     {
-        cout << "- 6 byte packet headers" << endl;
+        os << "- 6 byte packet headers" << endl;
     }
 
     if (_header_triad_present)
     {
-        cout << "- Vorbis header triad present" << endl;
+        os << "- Vorbis header triad present" << endl;
     }
 
     if (_full_setup || _header_triad_present)
     {
-        cout << "- full setup header" << endl;
+        os << "- full setup header" << endl;
     }
     else
     {
-        cout << "- stripped setup header" << endl;
+        os << "- stripped setup header" << endl;
     }
 
     if (_inline_codebooks || _header_triad_present)
     {
-        cout << "- inline codebooks" << endl;
+        os << "- inline codebooks" << endl;
     }
     else
     {
-        cout << "- external codebooks (" << _codebooks_name << ")" << endl;
+        os << "- external codebooks (" << _codebooks_name << ")" << endl;
     }
 
     if (_mod_packets)
     {
-        cout << "- modified Vorbis packets" << endl;
+        os << "- modified Vorbis packets" << endl;
     }
     else
     {
-        cout << "- standard Vorbis packets" << endl;
+        os << "- standard Vorbis packets" << endl;
     }
 
 #if 0
     if (0 != _cue_count)
     {
-        cout << _cue_count << " cue point";
-        if (_cue_count != 1) cout << "s";
-        cout << endl;
+        os << _cue_count << " cue point";
+        if (_cue_count != 1) os << "s";
+        os << endl;
     }
 #endif
 }
 
-void Wwise_RIFF_Vorbis::generate_ogg_header(Bit_oggstream& os, bool * & mode_blockflag, int & mode_bits)
+void Wwise_RIFF_Vorbis::generate_ogg_header(Bit_oggstream& os, vector<bool>& mode_blockflag, int & mode_bits)
 {
     // generate identification packet
     {
@@ -634,558 +769,742 @@ void Wwise_RIFF_Vorbis::generate_ogg_header(Bit_oggstream& os, bool * & mode_blo
 
         os << vhead;
 
-        Packet setup_packet(_infile, _data_offset + _setup_packet_offset, _little_endian, _no_granule);
+        Packet setup_packet(_input, _data_offset + _setup_packet_offset, _little_endian, _no_granule);
 
-        _infile.seekg(setup_packet.offset());
         if (setup_packet.granule() != 0) throw Parse_error_str("setup packet granule != 0");
-        Bit_stream ss(_infile);
+        unsigned long setup_size = setup_packet.size();
+        const unsigned char * setup_data = _input.get_available(setup_packet.offset(), setup_size);
 
-        // codebook count
-        Bit_uint<8> codebook_count_less1;
-        ss >> codebook_count_less1;
-        unsigned int codebook_count = codebook_count_less1 + 1;
-        os << codebook_count_less1;
+        // external codebooks, shared if we were given them; otherwise only
+        // loaded up front if the cache key needs them
+        const codebook_library * cbl = _inline_codebooks ? NULL : _codebooks;
+        auto_ptr<codebook_library> loaded;
 
-        //cout << codebook_count << " codebooks" << endl;
+        const Setup_header * setup = NULL;
+        string key;
 
-        // rebuild codebooks
-        if (_inline_codebooks)
+        if (_setup_cache)
         {
-            codebook_library cbl;
+            if (!_inline_codebooks && !cbl)
+            {
+                Stats_stage stage(_stats, Conversion_stats::codebooks);
+                cbl = &open_codebook_library(_codebooks_name, loaded);
+            }
 
-            for (unsigned int i = 0; i < codebook_count; i++)
+            // everything the translation depends on
+            ostringstream key_stream;
+            key_stream << VERSION << ' ' << _inline_codebooks << _full_setup << ' ' << _channels << ' '
+                       << (cbl ? cbl->get_identity() : 0) << ' ' << setup_packet.size() << ' ';
+            key = key_stream.str();
+            key.append(reinterpret_cast<const char *>(setup_data), setup_size);
+
+            setup = _setup_cache->find(key, setup_packet.size());
+        }
+
+        auto_ptr<Setup_header> fresh;
+        if (!setup)
+        {
+            fresh.reset(new Setup_header);
+
+            try
             {
-                if (_full_setup)
-                {
-                    cbl.copy(ss, os);
-                }
-                else
-                {
-                    cbl.rebuild(ss, 0, os);
-                }
+                rebuild_setup(setup_data, setup_size, setup_packet.size(), cbl, *fresh);
             }
+            catch (...)
+            {
+                // output what we got as far as before
+                fresh->bits.append_to(os);
+                throw;
+            }
+
+            setup = fresh.get();
+            if (_setup_cache) setup = _setup_cache->insert(key, fresh.release());
         }
-        else
+
+        setup->bits.append_to(os);
+
+        if (!setup->mode_blockflag.empty())
         {
-            /* external codebooks */
+            mode_blockflag = setup->mode_blockflag;
+            mode_bits = setup->mode_bits;
+        }
 
-            codebook_library cbl(_codebooks_name);
+        os.flush_page();
 
-            for (unsigned int i = 0; i < codebook_count; i++)
+        if ((setup->bits_read+7)/8 != setup_packet.size()) throw Parse_error_str("didn't read exactly setup packet");
+
+        if (setup_packet.next_offset() != _data_offset + static_cast<long>(_first_audio_packet_offset)) throw Parse_error_str("first audio packet doesn't follow setup packet");
+
+    }
+}
+
+// translate the Wwise setup packet into the rest of a Vorbis one, in out
+void Wwise_RIFF_Vorbis::rebuild_setup(const unsigned char * setup_data, unsigned long setup_size, unsigned long packet_size, const codebook_library * external_cbl, Setup_header& out)
+{
+    Bit_bufstream& os = out.bits;
+    Bit_stream ss(setup_data, setup_size);
+
+    // codebook count
+    Bit_uint<8> codebook_count_less1;
+    ss >> codebook_count_less1;
+    unsigned int codebook_count = codebook_count_less1 + 1;
+    os << codebook_count_less1;
+
+    //cout << codebook_count << " codebooks" << endl;
+
+    // rebuild codebooks
+    if (_inline_codebooks)
+    {
+        Stats_stage stage(_stats, Conversion_stats::codebooks);
+        codebook_library cbl;
+
+        for (unsigned int i = 0; i < codebook_count; i++)
+        {
+            if (_full_setup)
             {
-                Bit_uint<10> codebook_id;
-                ss >> codebook_id;
-                //cout << "Codebook " << i << " = " << codebook_id << endl;
-                try
-                {
-                    cbl.rebuild(codebook_id, os);
-                }
-                catch (Invalid_id e)
+                cbl.copy(ss, os);
+            }
+            else
+            {
+                cbl.rebuild(ss, 0, os);
+            }
+        }
+    }
+    else
+    {
+        /* external codebooks */
+
+        Stats_stage stage(_stats, Conversion_stats::codebooks);
+        auto_ptr<codebook_library> loaded;
+        const codebook_library& cbl = external_cbl ? *external_cbl : open_codebook_library(_codebooks_name, loaded);
+
+        for (unsigned int i = 0; i < codebook_count; i++)
+        {
+            Bit_uint<10> codebook_id;
+            ss >> codebook_id;
+            //cout << "Codebook " << i << " = " << codebook_id << endl;
+            try
+            {
+                cbl.rebuild(codebook_id, os);
+            }
+            catch (Invalid_id e)
+            {
+                //         B         C         V
+                //    4    2    4    3    5    6
+                // 0100 0010 0100 0011 0101 0110
+                // \_______|____ ___|/
+                //              X
+                //            11 0100 0010
+
+                if (codebook_id == 0x342)
                 {
+                    Bit_uint<14> codebook_identifier;
+                    ss >> codebook_identifier;
+
                     //         B         C         V
                     //    4    2    4    3    5    6
                     // 0100 0010 0100 0011 0101 0110
-                    // \_______|____ ___|/
-                    //              X
-                    //            11 0100 0010
-
-                    if (codebook_id == 0x342)
+                    //           \_____|_ _|_______/
+                    //                   X
+                    //         01 0101 10 01 0000
+                    if (codebook_identifier == 0x1590)
                     {
-                        Bit_uint<14> codebook_identifier;
-                        ss >> codebook_identifier;
-
-                        //         B         C         V
-                        //    4    2    4    3    5    6
-                        // 0100 0010 0100 0011 0101 0110
-                        //           \_____|_ _|_______/
-                        //                   X
-                        //         01 0101 10 01 0000
-                        if (codebook_identifier == 0x1590)
-                        {
-                            // starts with BCV, probably --full-setup
-                            throw Parse_error_str(
-                                "invalid codebook id 0x342, try --full-setup");
-                        }
+                        // starts with BCV, probably --full-setup
+                        throw Parse_error_str(
+                            "invalid codebook id 0x342, try --full-setup");
                     }
-
-                    // just an invalid codebook
-                    throw e;
                 }
+
+                // just an invalid codebook
+                throw e;
             }
         }
+    }
 
-        // Time Domain transforms (placeholder)
-        Bit_uint<6> time_count_less1(0);
-        os << time_count_less1;
-        Bit_uint<16> dummy_time_value(0);
-        os << dummy_time_value;
+    // Time Domain transforms (placeholder)
+    Bit_uint<6> time_count_less1(0);
+    os << time_count_less1;
+    Bit_uint<16> dummy_time_value(0);
+    os << dummy_time_value;
 
-        if (_full_setup)
-        {
+    if (_full_setup)
+    {
 
-            while (ss.get_total_bits_read() < setup_packet.size()*8u)
-            {
-                Bit_uint<1> bitly;
-                ss >> bitly;
-                os << bitly;
-            }
+        while (ss.get_total_bits_read() < packet_size*8u)
+        {
+            Bit_uint<1> bitly;
+            ss >> bitly;
+            os << bitly;
         }
-        else    // _full_setup
+    }
+    else    // _full_setup
+    {
+        // floor count
+        Bit_uint<6> floor_count_less1;
+        ss >> floor_count_less1;
+        unsigned int floor_count = floor_count_less1 + 1;
+        os << floor_count_less1;
+
+        // rebuild floors
+        for (unsigned int i = 0; i < floor_count; i++)
         {
-            // floor count
-            Bit_uint<6> floor_count_less1;
-            ss >> floor_count_less1;
-            unsigned int floor_count = floor_count_less1 + 1;
-            os << floor_count_less1;
-
-            // rebuild floors
-            for (unsigned int i = 0; i < floor_count; i++)
-            {
-                // Always floor type 1
-                Bit_uint<16> floor_type(1);
-                os << floor_type;
+            // Always floor type 1
+            Bit_uint<16> floor_type(1);
+            os << floor_type;
 
-                Bit_uint<5> floor1_partitions;
-                ss >> floor1_partitions;
-                os << floor1_partitions;
+            Bit_uint<5> floor1_partitions;
+            ss >> floor1_partitions;
+            os << floor1_partitions;
 
-                unsigned int * floor1_partition_class_list = new unsigned int [floor1_partitions];
+            unsigned int * floor1_partition_class_list = new unsigned int [floor1_partitions];
 
-                unsigned int maximum_class = 0;
-                for (unsigned int j = 0; j < floor1_partitions; j++)
-                {
-                    Bit_uint<4> floor1_partition_class;
-                    ss >> floor1_partition_class;
-                    os << floor1_partition_class;
+            unsigned int maximum_class = 0;
+            for (unsigned int j = 0; j < floor1_partitions; j++)
+            {
+                Bit_uint<4> floor1_partition_class;
+                ss >> floor1_partition_class;
+                os << floor1_partition_class;
 
-                    floor1_partition_class_list[j] = floor1_partition_class;
+                floor1_partition_class_list[j] = floor1_partition_class;
 
-                    if (floor1_partition_class > maximum_class)
-                        maximum_class = floor1_partition_class;
-                }
+                if (floor1_partition_class > maximum_class)
+                    maximum_class = floor1_partition_class;
+            }
 
-                unsigned int * floor1_class_dimensions_list = new unsigned int [maximum_class+1];
+            unsigned int * floor1_class_dimensions_list = new unsigned int [maximum_class+1];
 
-                for (unsigned int j = 0; j <= maximum_class; j++)
-                {
-                    Bit_uint<3> class_dimensions_less1;
-                    ss >> class_dimensions_less1;
-                    os << class_dimensions_less1;
+            for (unsigned int j = 0; j <= maximum_class; j++)
+            {
+                Bit_uint<3> class_dimensions_less1;
+                ss >> class_dimensions_less1;
+                os << class_dimensions_less1;
 
-                    floor1_class_dimensions_list[j] = class_dimensions_less1 + 1;
+                floor1_class_dimensions_list[j] = class_dimensions_less1 + 1;
 
-                    Bit_uint<2> class_subclasses;
-                    ss >> class_subclasses;
-                    os << class_subclasses;
+                Bit_uint<2> class_subclasses;
+                ss >> class_subclasses;
+                os << class_subclasses;
 
-                    if (0 != class_subclasses)
-                    {
-                        Bit_uint<8> masterbook;
-                        ss >> masterbook;
-                        os << masterbook;
+                if (0 != class_subclasses)
+                {
+                    Bit_uint<8> masterbook;
+                    ss >> masterbook;
+                    os << masterbook;
 
-                        if (masterbook >= codebook_count)
-                            throw Parse_error_str("invalid floor1 masterbook");
-                    }
+                    if (masterbook >= codebook_count)
+                        throw Parse_error_str("invalid floor1 masterbook");
+                }
 
-                    for (unsigned int k = 0; k < (1U<<class_subclasses); k++)
-                    {
-                        Bit_uint<8> subclass_book_plus1;
-                        ss >> subclass_book_plus1;
-                        os << subclass_book_plus1;
+                for (unsigned int k = 0; k < (1U<<class_subclasses); k++)
+                {
+                    Bit_uint<8> subclass_book_plus1;
+                    ss >> subclass_book_plus1;
+                    os << subclass_book_plus1;
 
-                        int subclass_book = static_cast<int>(subclass_book_plus1)-1;
-                        if (subclass_book >= 0 && static_cast<unsigned int>(subclass_book) >= codebook_count)
-                            throw Parse_error_str("invalid floor1 subclass book");
-                    }
+                    int subclass_book = static_cast<int>(subclass_book_plus1)-1;
+                    if (subclass_book >= 0 && static_cast<unsigned int>(subclass_book) >= codebook_count)
+                        throw Parse_error_str("invalid floor1 subclass book");
                 }
+            }
 
-                Bit_uint<2> floor1_multiplier_less1;
-                ss >> floor1_multiplier_less1;
-                os << floor1_multiplier_less1;
+            Bit_uint<2> floor1_multiplier_less1;
+            ss >> floor1_multiplier_less1;
+            os << floor1_multiplier_less1;
 
-                Bit_uint<4> rangebits;
-                ss >> rangebits;
-                os << rangebits;
+            Bit_uint<4> rangebits;
+            ss >> rangebits;
+            os << rangebits;
 
-                for (unsigned int j = 0; j < floor1_partitions; j++)
+            for (unsigned int j = 0; j < floor1_partitions; j++)
+            {
+                unsigned int current_class_number = floor1_partition_class_list[j];
+                for (unsigned int k = 0; k < floor1_class_dimensions_list[current_class_number]; k++)
                 {
-                    unsigned int current_class_number = floor1_partition_class_list[j];
-                    for (unsigned int k = 0; k < floor1_class_dimensions_list[current_class_number]; k++)
-                    {
-                        Bit_uintv X(rangebits);
-                        ss >> X;
-                        os << X;
-                    }
+                    Bit_uintv X(rangebits);
+                    ss >> X;
+                    os << X;
                 }
-
-                delete [] floor1_class_dimensions_list;
-                delete [] floor1_partition_class_list;
             }
 
-            // residue count
-            Bit_uint<6> residue_count_less1;
-            ss >> residue_count_less1;
-            unsigned int residue_count = residue_count_less1 + 1;
-            os << residue_count_less1;
+            delete [] floor1_class_dimensions_list;
+            delete [] floor1_partition_class_list;
+        }
 
-            // rebuild residues
-            for (unsigned int i = 0; i < residue_count; i++)
-            {
-                Bit_uint<2> residue_type;
-                ss >> residue_type;
-                os << Bit_uint<16>(residue_type);
+        // residue count
+        Bit_uint<6> residue_count_less1;
+        ss >> residue_count_less1;
+        unsigned int residue_count = residue_count_less1 + 1;
+        os << residue_count_less1;
 
-                if (residue_type > 2) throw Parse_error_str("invalid residue type");
+        // rebuild residues
+        for (unsigned int i = 0; i < residue_count; i++)
+        {
+            Bit_uint<2> residue_type;
+            ss >> residue_type;
+            os << Bit_uint<16>(residue_type);
 
-                Bit_uint<24> residue_begin, residue_end, residue_partition_size_less1;
-                Bit_uint<6> residue_classifications_less1;
-                Bit_uint<8> residue_classbook;
+            if (residue_type > 2) throw Parse_error_str("invalid residue type");
 
-                ss >> residue_begin >> residue_end >> residue_partition_size_less1 >> residue_classifications_less1 >> residue_classbook;
-                unsigned int residue_classifications = residue_classifications_less1 + 1;
-                os << residue_begin << residue_end << residue_partition_size_less1 << residue_classifications_less1 << residue_classbook;
+            Bit_uint<24> residue_begin, residue_end, residue_partition_size_less1;
+            Bit_uint<6> residue_classifications_less1;
+            Bit_uint<8> residue_classbook;
 
-                if (residue_classbook >= codebook_count) throw Parse_error_str("invalid residue classbook");
+            ss >> residue_begin >> residue_end >> residue_partition_size_less1 >> residue_classifications_less1 >> residue_classbook;
+            unsigned int residue_classifications = residue_classifications_less1 + 1;
+            os << residue_begin << residue_end << residue_partition_size_less1 << residue_classifications_less1 << residue_classbook;
 
-                unsigned int * residue_cascade = new unsigned int [residue_classifications];
+            if (residue_classbook >= codebook_count) throw Parse_error_str("invalid residue classbook");
 
-                for (unsigned int j = 0; j < residue_classifications; j++)
-                {
-                    Bit_uint<5> high_bits(0);
-                    Bit_uint<3> low_bits;
+            unsigned int * residue_cascade = new unsigned int [residue_classifications];
 
-                    ss >> low_bits;
-                    os << low_bits;
+            for (unsigned int j = 0; j < residue_classifications; j++)
+            {
+                Bit_uint<5> high_bits(0);
+                Bit_uint<3> low_bits;
 
-                    Bit_uint<1> bitflag;
-                    ss >> bitflag;
-                    os << bitflag;
-                    if (bitflag)
-                    {
-                        ss >> high_bits;
-                        os << high_bits;
-                    }
+                ss >> low_bits;
+                os << low_bits;
 
-                    residue_cascade[j] = high_bits * 8 + low_bits;
+                Bit_uint<1> bitflag;
+                ss >> bitflag;
+                os << bitflag;
+                if (bitflag)
+                {
+                    ss >> high_bits;
+                    os << high_bits;
                 }
 
-                for (unsigned int j = 0; j < residue_classifications; j++)
+                residue_cascade[j] = high_bits * 8 + low_bits;
+            }
+
+            for (unsigned int j = 0; j < residue_classifications; j++)
+            {
+                for (unsigned int k = 0; k < 8; k++)
                 {
-                    for (unsigned int k = 0; k < 8; k++)
+                    if (residue_cascade[j] & (1 << k))
                     {
-                        if (residue_cascade[j] & (1 << k))
-                        {
-                            Bit_uint<8> residue_book;
-                            ss >> residue_book;
-                            os << residue_book;
+                        Bit_uint<8> residue_book;
+                        ss >> residue_book;
+                        os << residue_book;
 
-                            if (residue_book >= codebook_count) throw Parse_error_str("invalid residue book");
-                        }
+                        if (residue_book >= codebook_count) throw Parse_error_str("invalid residue book");
                     }
                 }
-
-                delete [] residue_cascade;
             }
 
-            // mapping count
-            Bit_uint<6> mapping_count_less1;
-            ss >> mapping_count_less1;
-            unsigned int mapping_count = mapping_count_less1 + 1;
-            os << mapping_count_less1;
-
-            for (unsigned int i = 0; i < mapping_count; i++)
-            {
-                // always mapping type 0, the only one
-                Bit_uint<16> mapping_type(0);
-
-                os << mapping_type;
-
-                Bit_uint<1> submaps_flag;
-                ss >> submaps_flag;
-                os << submaps_flag;
+            delete [] residue_cascade;
+        }
 
-                unsigned int submaps = 1;
-                if (submaps_flag)
-                {
-                    Bit_uint<4> submaps_less1;
+        // mapping count
+        Bit_uint<6> mapping_count_less1;
+        ss >> mapping_count_less1;
+        unsigned int mapping_count = mapping_count_less1 + 1;
+        os << mapping_count_less1;
 
-                    ss >> submaps_less1;
-                    submaps = submaps_less1 + 1;
-                    os << submaps_less1;
-                }
+        for (unsigned int i = 0; i < mapping_count; i++)
+        {
+            // always mapping type 0, the only one
+            Bit_uint<16> mapping_type(0);
 
-                Bit_uint<1> square_polar_flag;
-                ss >> square_polar_flag;
-                os << square_polar_flag;
+            os << mapping_type;
 
-                if (square_polar_flag)
-                {
-                    Bit_uint<8> coupling_steps_less1;
-                    ss >> coupling_steps_less1;
-                    unsigned int coupling_steps = coupling_steps_less1 + 1;
-                    os << coupling_steps_less1;
+            Bit_uint<1> submaps_flag;
+            ss >> submaps_flag;
+            os << submaps_flag;
 
-                    for (unsigned int j = 0; j < coupling_steps; j++)
-                    {
-                        Bit_uintv magnitude(ilog(_channels-1)), angle(ilog(_channels-1));
+            unsigned int submaps = 1;
+            if (submaps_flag)
+            {
+                Bit_uint<4> submaps_less1;
 
-                        ss >> magnitude >> angle;
-                        os << magnitude << angle;
+                ss >> submaps_less1;
+                submaps = submaps_less1 + 1;
+                os << submaps_less1;
+            }
 
-                        if (angle == magnitude || magnitude >= _channels || angle >= _channels) throw Parse_error_str("invalid coupling");
-                    }
-                }
+            Bit_uint<1> square_polar_flag;
+            ss >> square_polar_flag;
+            os << square_polar_flag;
 
-                // a rare reserved field not removed by Ak!
-                Bit_uint<2> mapping_reserved;
-                ss >> mapping_reserved;
-                os << mapping_reserved;
-                if (0 != mapping_reserved) throw Parse_error_str("mapping reserved field nonzero");
+            if (square_polar_flag)
+            {
+                Bit_uint<8> coupling_steps_less1;
+                ss >> coupling_steps_less1;
+                unsigned int coupling_steps = coupling_steps_less1 + 1;
+                os << coupling_steps_less1;
 
-                if (submaps > 1)
+                for (unsigned int j = 0; j < coupling_steps; j++)
                 {
-                    for (unsigned int j = 0; j < _channels; j++)
-                    {
-                        Bit_uint<4> mapping_mux;
-                        ss >> mapping_mux;
-                        os << mapping_mux;
+                    Bit_uintv magnitude(ilog(_channels-1)), angle(ilog(_channels-1));
 
-                        if (mapping_mux >= submaps) throw Parse_error_str("mapping_mux >= submaps");
-                    }
-                }
+                    ss >> magnitude >> angle;
+                    os << magnitude << angle;
 
-                for (unsigned int j = 0; j < submaps; j++)
-                {
-                    // Another! Unused time domain transform configuration placeholder!
-                    Bit_uint<8> time_config;
-                    ss >> time_config;
-                    os << time_config;
-
-                    Bit_uint<8> floor_number;
-                    ss >> floor_number;
-                    os << floor_number;
-                    if (floor_number >= floor_count) throw Parse_error_str("invalid floor mapping");
-
-                    Bit_uint<8> residue_number;
-                    ss >> residue_number;
-                    os << residue_number;
-                    if (residue_number >= residue_count) throw Parse_error_str("invalid residue mapping");
+                    if (angle == magnitude || magnitude >= _channels || angle >= _channels) throw Parse_error_str("invalid coupling");
                 }
             }
 
-            // mode count
-            Bit_uint<6> mode_count_less1;
-            ss >> mode_count_less1;
-            unsigned int mode_count = mode_count_less1 + 1;
-            os << mode_count_less1;
+            // a rare reserved field not removed by Ak!
+            Bit_uint<2> mapping_reserved;
+            ss >> mapping_reserved;
+            os << mapping_reserved;
+            if (0 != mapping_reserved) throw Parse_error_str("mapping reserved field nonzero");
 
-            mode_blockflag = new bool [mode_count];
-            mode_bits = ilog(mode_count-1);
+            if (submaps > 1)
+            {
+                for (unsigned int j = 0; j < _channels; j++)
+                {
+                    Bit_uint<4> mapping_mux;
+                    ss >> mapping_mux;
+                    os << mapping_mux;
 
-            //cout << mode_count << " modes" << endl;
+                    if (mapping_mux >= submaps) throw Parse_error_str("mapping_mux >= submaps");
+                }
+            }
 
-            for (unsigned int i = 0; i < mode_count; i++)
+            for (unsigned int j = 0; j < submaps; j++)
             {
-                Bit_uint<1> block_flag;
-                ss >> block_flag;
-                os << block_flag;
+                // Another! Unused time domain transform configuration placeholder!
+                Bit_uint<8> time_config;
+                ss >> time_config;
+                os << time_config;
+
+                Bit_uint<8> floor_number;
+                ss >> floor_number;
+                os << floor_number;
+                if (floor_number >= floor_count) throw Parse_error_str("invalid floor mapping");
+
+                Bit_uint<8> residue_number;
+                ss >> residue_number;
+                os << residue_number;
+                if (residue_number >= residue_count) throw Parse_error_str("invalid residue mapping");
+            }
+        }
 
-                mode_blockflag[i] = (block_flag != 0);
+        // mode count
+        Bit_uint<6> mode_count_less1;
+        ss >> mode_count_less1;
+        unsigned int mode_count = mode_count_less1 + 1;
+        os << mode_count_less1;
 
-                // only 0 valid for windowtype and transformtype
-                Bit_uint<16> windowtype(0), transformtype(0);
-                os << windowtype << transformtype;
+        out.mode_blockflag.resize(mode_count);
+        out.mode_bits = ilog(mode_count-1);
 
-                Bit_uint<8> mapping;
-                ss >> mapping;
-                os << mapping;
-                if (mapping >= mapping_count) throw Parse_error_str("invalid mode mapping");
-            }
+        //cout << mode_count << " modes" << endl;
 
-            Bit_uint<1> framing(1);
-            os << framing;
+        for (unsigned int i = 0; i < mode_count; i++)
+        {
+            Bit_uint<1> block_flag;
+            ss >> block_flag;
+            os << block_flag;
 
-        } // _full_setup
+            out.mode_blockflag[i] = (block_flag != 0);
 
-        os.flush_page();
+            // only 0 valid for windowtype and transformtype
+            Bit_uint<16> windowtype(0), transformtype(0);
+            os << windowtype << transformtype;
 
-        if ((ss.get_total_bits_read()+7)/8 != setup_packet.size()) throw Parse_error_str("didn't read exactly setup packet");
+            Bit_uint<8> mapping;
+            ss >> mapping;
+            os << mapping;
+            if (mapping >= mapping_count) throw Parse_error_str("invalid mode mapping");
+        }
 
-        if (setup_packet.next_offset() != _data_offset + static_cast<long>(_first_audio_packet_offset)) throw Parse_error_str("first audio packet doesn't follow setup packet");
+        Bit_uint<1> framing(1);
+        os << framing;
 
-    }
+    } // _full_setup
+
+    out.bits_read = ss.get_total_bits_read();
+    stats_add(_stats, Conversion_stats::bits_read, out.bits_read);
 }
 
-void Wwise_RIFF_Vorbis::generate_ogg(ofstream& of)
+void Wwise_RIFF_Vorbis::generate_ogg(ostream& of, unsigned int page_size, bool recompute_granules, unsigned int threads)
 {
-    Bit_oggstream os(of);
+    Bit_oggstream os(of, page_size, _stats);
 
-    bool * mode_blockflag = NULL;
+    vector<bool> mode_blockflag;
     int mode_bits = 0;
-    bool prev_blockflag = false;
 
-    if (_header_triad_present)
     {
-        generate_ogg_header_with_triad(os);
-    }
-    else
-    {
-        generate_ogg_header(os, mode_blockflag, mode_bits);
+        Stats_stage stage(_stats, Conversion_stats::setup);
+
+        if (_header_triad_present)
+        {
+            generate_ogg_header_with_triad(os);
+        }
+        else
+        {
+            generate_ogg_header(os, mode_blockflag, mode_bits);
+        }
     }
 
     // Audio pages
     {
-        long offset = _data_offset + _first_audio_packet_offset;
+        Stats_stage stage(_stats, Conversion_stats::audio);
+
+        const long data_end = _data_offset + _data_size;
+        const long first_offset = _data_offset + _first_audio_packet_offset;
+
+        _input.advise_sequential(first_offset, data_end - first_offset);
 
-        while (offset < _data_offset + _data_size)
+        // without the mode table (the setup header is copied as is) the
+        // stored granules are all there is
+        if (mode_blockflag.empty()) recompute_granules = false;
+
+        Packet_index index;
+        index_audio_packets(index, (_mod_packets || recompute_granules) ? &mode_blockflag : NULL, mode_bits);
+
+        const size_t packet_count = index.payload.size();
+
+        // from here on index.granule is what goes on the pages
+        if (recompute_granules)
         {
-            uint32_t size, granule;
-            long packet_header_size, packet_payload_offset, next_offset;
+            const uint32_t blocksize[2] = {UINT32_C(1) << _blocksize_0_pow, UINT32_C(1) << _blocksize_1_pow};
+            uint32_t samples = 0;
 
-            if (_old_packet_headers)
+            for (size_t i = 0; i < packet_count; i++)
             {
-                Packet_8 audio_packet(_infile, offset, _little_endian);
-                packet_header_size = audio_packet.header_size();
-                size = audio_packet.size();
-                packet_payload_offset = audio_packet.offset();
-                granule = audio_packet.granule();
-                next_offset = audio_packet.next_offset();
+                // each packet after the first finishes the overlap with
+                // the one before it: a quarter of each of their blocks
+                if (i > 0)
+                {
+                    samples += (blocksize[index.blockflag[i-1]] + blocksize[index.blockflag[i]]) / 4;
+                }
+
+                // the end of the last block is padding, trimmed this way
+                if (index.payload[i] + index.size[i] == data_end && samples > _sample_count)
+                {
+                    index.granule[i] = _sample_count;
+                }
+                else
+                {
+                    index.granule[i] = samples;
+                }
             }
-            else
+        }
+        else
+        {
+            for (size_t i = 0; i < packet_count; i++)
             {
-                Packet audio_packet(_infile, offset, _little_endian, _no_granule);
-                packet_header_size = audio_packet.header_size();
-                size = audio_packet.size();
-                packet_payload_offset = audio_packet.offset();
-                granule = audio_packet.granule();
-                next_offset = audio_packet.next_offset();
+                // HACK: don't know what to do here
+                if (index.granule[i] == UINT32_C(0xFFFFFFFF)) index.granule[i] = 1;
             }
+        }
 
-            if (offset + packet_header_size > _data_offset + _data_size) {
-                throw Parse_error_str("page header truncated");
-            }
+        // a page per packet can be made anywhere, as its sequence number
+        // is known up front; packed pages depend on everything before them
+        if (threads > 1 && 0 == page_size && packet_count >= 2 * min_chunk_packets)
+        {
+            write_audio_packets_parallel(os, of, index, !mode_blockflag.empty(), mode_bits, threads);
+        }
+        else
+        {
+            write_audio_packets(os, index, 0, packet_count, !mode_blockflag.empty(), mode_bits, _stats);
+        }
+
+        if (index.stop) throw Parse_error_str(index.stop);
+        if (index.end_offset > data_end) throw Parse_error_str("page truncated");
+    }
+}
+
+void Wwise_RIFF_Vorbis::write_audio_packets_parallel(Bit_oggstream& os, ostream& of, const Packet_index& index,
+        bool have_mode_blockflag, int mode_bits, unsigned int threads) const
+{
+    // enough chunks that threads finishing early find more to take
+    size_t chunk_packets = index.payload.size() / (threads * 8);
+    if (chunk_packets < min_chunk_packets) chunk_packets = min_chunk_packets;
+
+    Audio_chunks chunks(*this, index, of, have_mode_blockflag, mode_bits, os.get_seqno(), chunk_packets, _stats);
+
+    vector<size_t> order;
+    for (size_t i = 0; i < chunks.count(); i++)
+    {
+        order.push_back(i);
+    }
+
+    run_work_stealing(chunks, order, threads);
+    chunks.check();
+}
+
+// packets begin to end, exactly as if converting the whole file
+void Wwise_RIFF_Vorbis::write_audio_packets(Bit_oggstream& os, const Packet_index& index,
+        size_t begin, size_t end, bool have_mode_blockflag, int mode_bits, Conversion_stats * stats) const
+{
+    const long data_end = _data_offset + _data_size;
+    const long packet_header_size = audio_packet_header_size();
+    const size_t packet_count = index.payload.size();
+
+    bool prev_blockflag = (begin > 0 && !index.blockflag.empty()) ? (index.blockflag[begin-1] != 0) : false;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const long offset = index.payload[i];
+        const uint32_t size = index.size[i];
+        const long next_offset = offset + size;
+
+        os.set_granule(index.granule[i]);
 
-            offset = packet_payload_offset;
+        // first byte
+        if (_mod_packets)
+        {
+            // need to rebuild packet type and window info
 
-            _infile.seekg(offset);
-            // HACK: don't know what to do here
-            if (granule == UINT32_C(0xFFFFFFFF))
+            if (!have_mode_blockflag)
             {
-                os.set_granule(1);
+                throw Parse_error_str("didn't load mode_blockflag");
             }
-            else
+
+            // OUT: 1 bit packet type (0 == audio)
+            Bit_uint<1> packet_type(0);
+            os << packet_type;
+
+            if (Packet_index::no_mode == index.mode[i])
             {
-                os.set_granule(granule);
+                throw Parse_error_str("file truncated");
             }
 
-            // first byte
-            if (_mod_packets)
+            // IN/OUT: N bit mode number (max 6 bits)
+            os.put_bits(index.mode[i], mode_bits);
+
+            if (index.blockflag[i])
             {
-                // need to rebuild packet type and window info
+                // long window, next frame's window from the index
 
-                if (!mode_blockflag)
+                bool next_blockflag = false;
+                if (next_offset + packet_header_size <= data_end)
                 {
-                    throw Parse_error_str("didn't load mode_blockflag");
+                    // a header there was either indexed or is what
+                    // stopped the index
+                    if (i + 1 == packet_count)
+                    {
+                        throw Parse_error_str(index.stop);
+                    }
+                    if (index.size[i+1] > 0)
+                    {
+                        if (Packet_index::no_mode == index.mode[i+1])
+                        {
+                            throw Parse_error_str("file truncated");
+                        }
+                        next_blockflag = index.blockflag[i+1];
+                    }
                 }
 
-                // OUT: 1 bit packet type (0 == audio)
-                Bit_uint<1> packet_type(0);
-                os << packet_type;
-
-                Bit_uintv * mode_number_p = 0;
-                Bit_uintv * remainder_p = 0;
-
-                {
-                    // collect mode number from first byte
-
-                    Bit_stream ss(_infile);
+                // OUT: previous window type bit
+                Bit_uint<1> prev_window_type(prev_blockflag);
+                os << prev_window_type;
 
-                    // IN/OUT: N bit mode number (max 6 bits)
-                    mode_number_p = new Bit_uintv(mode_bits);
-                    ss >> *mode_number_p;
-                    os << *mode_number_p;
+                // OUT: next window type bit
+                Bit_uint<1> next_window_type(next_blockflag);
+                os << next_window_type;
+            }
 
-                    // IN: remaining bits of first (input) byte
-                    remainder_p = new Bit_uintv(8-mode_bits);
-                    ss >> *remainder_p;
-                }
+            prev_blockflag = index.blockflag[i];
 
-                if (mode_blockflag[*mode_number_p])
-                {
-                    // long window, peek at next frame
+            // OUT: remaining bits of first (input) byte
+            os.put_bits(*_input.get(offset, 1) >> mode_bits, 8-mode_bits);
+        }
+        else
+        {
+            // nothing unusual for first byte
+            const unsigned char * first_byte = _input.get(offset, 1);
+            if (!first_byte)
+            {
+                throw Parse_error_str("file truncated");
+            }
+            Bit_uint<8> c(*first_byte);
+            os << c;
+        }
 
-                    _infile.seekg(next_offset);
-                    bool next_blockflag = false;
-                    if (next_offset + packet_header_size <= _data_offset + _data_size)
-                    {
+        // remainder of packet
+        if (size > 1)
+        {
+            unsigned long rest_size = size-1;
+            const unsigned char * rest = _input.get_available(offset+1, rest_size);
+            os.put_bytes(rest, rest_size);
+            if (rest_size != size-1)
+            {
+                throw Parse_error_str("file truncated");
+            }
+        }
 
-                        // mod_packets always goes with 6-byte headers
-                        Packet audio_packet(_infile, next_offset, _little_endian, _no_granule);
-                        uint32_t next_packet_size = audio_packet.size();
-                        if (next_packet_size > 0)
-                        {
-                            _infile.seekg(audio_packet.offset());
+        os.end_packet(next_offset == data_end);
 
-                            Bit_stream ss(_infile);
-                            Bit_uintv next_mode_number(mode_bits);
+        stats_add(stats, Conversion_stats::packets, 1);
+        stats_add(stats, Conversion_stats::bits_read, static_cast<uint64_t>(size) * 8);
+    }
+}
 
-                            ss >> next_mode_number;
+long Wwise_RIFF_Vorbis::audio_packet_header_size(void) const
+{
+    if (_old_packet_headers) return 8;
+    return _no_granule ? 2 : 6;
+}
 
-                            next_blockflag = mode_blockflag[next_mode_number];
-                        }
-                    }
+// stops at the first header that can't be read, as the conversion would;
+// modes are only looked up given mode_blockflag, and a mode past the end
+// of it counts as a short block
+void Wwise_RIFF_Vorbis::index_audio_packets(Packet_index& index, const vector<bool> * mode_blockflag, int mode_bits) const
+{
+    const long data_end = _data_offset + _data_size;
+    const long header_size = audio_packet_header_size();
+    const unsigned int mode_mask = (1U << mode_bits) - 1;
+    // a standard packet starts with the packet type bit
+    const unsigned int mode_shift = _mod_packets ? 0 : 1;
 
-                    // OUT: previous window type bit
-                    Bit_uint<1> prev_window_type(prev_blockflag);
-                    os << prev_window_type;
+    long offset = _data_offset + _first_audio_packet_offset;
 
-                    // OUT: next window type bit
-                    Bit_uint<1> next_window_type(next_blockflag);
-                    os << next_window_type;
+    while (offset < data_end)
+    {
+        const unsigned char * h = _input.get(offset, header_size);
+        if (!h)
+        {
+            index.stop = "packet header truncated";
+            break;
+        }
+        if (offset + header_size > data_end)
+        {
+            index.stop = "page header truncated";
+            break;
+        }
 
-                    // fix seek for rest of stream
-                    _infile.seekg(offset + 1);
-                }
+        uint32_t size, granule = 0;
+        if (_old_packet_headers)
+        {
+            size = _read_32(h);
+            granule = _read_32(h+4);
+        }
+        else
+        {
+            size = _read_16(h);
+            if (!_no_granule) granule = _read_32(h+2);
+        }
 
-                prev_blockflag = mode_blockflag[*mode_number_p];
-                delete mode_number_p;
+        const long payload = offset + header_size;
+        index.payload.push_back(payload);
+        index.size.push_back(size);
+        index.granule.push_back(granule);
 
-                // OUT: remaining bits of first (input) byte
-                os << *remainder_p;
-                delete remainder_p;
-            }
-            else
+        if (mode_blockflag)
+        {
+            const unsigned char * first_byte = _input.get(payload, 1);
+            if (first_byte)
             {
-                // nothing unusual for first byte
-                int v = _infile.get();
-                if (v < 0)
-                {
-                    throw Parse_error_str("file truncated");
-                }
-                Bit_uint<8> c(v);
-                os << c;
+                unsigned int mode = (*first_byte >> mode_shift) & mode_mask;
+                index.mode.push_back(mode);
+                index.blockflag.push_back(mode < mode_blockflag->size() && (*mode_blockflag)[mode]);
             }
-
-            // remainder of packet
-            for (unsigned int i = 1; i < size; i++)
+            else
             {
-                int v = _infile.get();
-                if (v < 0)
-                {
-                    throw Parse_error_str("file truncated");
-                }
-                Bit_uint<8> c(v);
-                os << c;
+                index.mode.push_back(Packet_index::no_mode);
+                index.blockflag.push_back(0);
             }
-
-            offset = next_offset;
-            os.flush_page( false, (offset == _data_offset + _data_size) );
         }
-        if (offset > _data_offset + _data_size) throw Parse_error_str("page truncated");
+
+        offset = payload + size;
     }
 
-    delete [] mode_blockflag;
+    index.end_offset = offset;
 }
 
 void Wwise_RIFF_Vorbis::generate_ogg_header_with_triad(Bit_oggstream& os)
@@ -1196,7 +1515,7 @@ void Wwise_RIFF_Vorbis::generate_ogg_header_with_triad(Bit_oggstream& os)
 
         // copy information packet
         {
-            Packet_8 information_packet(_infile, offset, _little_endian);
+            Packet_8 information_packet(_input, offset, _little_endian);
             uint32_t size = information_packet.size();
 
             if (information_packet.granule() != 0)
@@ -1204,9 +1523,13 @@ void Wwise_RIFF_Vorbis::generate_ogg_header_with_triad(Bit_oggstream& os)
                 throw Parse_error_str("information packet granule != 0");
             }
 
-            _infile.seekg(information_packet.offset());
+            const unsigned char * information_data = _input.get(information_packet.offset(), 1);
+            if (!information_data)
+            {
+                throw Parse_error_str("file truncated");
+            }
 
-            Bit_uint<8> c(_infile.get());
+            Bit_uint<8> c(*information_data);
             if (1 != c)
             {
                 throw Parse_error_str("wrong type for information packet");
@@ -1214,10 +1537,15 @@ void Wwise_RIFF_Vorbis::generate_ogg_header_with_triad(Bit_oggstream& os)
 
             os << c;
 
-            for (unsigned int i = 1; i < size; i++)
+            if (size > 1)
             {
-                c = _infile.get();
-                os << c;
+                unsigned long rest_size = size-1;
+                const unsigned char * rest = _input.get_available(information_packet.offset() + 1, rest_size);
+                os.put_bytes(rest, rest_size);
+                if (rest_size != size-1U)
+                {
+                    throw Parse_error_str("file truncated");
+                }
             }
 
             // identification packet on its own page
@@ -1228,7 +1556,7 @@ void Wwise_RIFF_Vorbis::generate_ogg_header_with_triad(Bit_oggstream& os)
 
         // copy comment packet 
         {
-            Packet_8 comment_packet(_infile, offset, _little_endian);
+            Packet_8 comment_packet(_input, offset, _little_endian);
             uint16_t size = comment_packet.size();
 
             if (comment_packet.granule() != 0)
@@ -1236,9 +1564,13 @@ void Wwise_RIFF_Vorbis::generate_ogg_header_with_triad(Bit_oggstream& os)
                 throw Parse_error_str("comment packet granule != 0");
             }
 
-            _infile.seekg(comment_packet.offset());
+            const unsigned char * comment_data = _input.get(comment_packet.offset(), 1);
+            if (!comment_data)
+            {
+                throw Parse_error_str("file truncated");
+            }
 
-            Bit_uint<8> c(_infile.get());
+            Bit_uint<8> c(*comment_data);
             if (3 != c)
             {
                 throw Parse_error_str("wrong type for comment packet");
@@ -1246,10 +1578,15 @@ void Wwise_RIFF_Vorbis::generate_ogg_header_with_triad(Bit_oggstream& os)
 
             os << c;
 
-            for (unsigned int i = 1; i < size; i++)
+            if (size > 1)
             {
-                c = _infile.get();
-                os << c;
+                unsigned long rest_size = size-1;
+                const unsigned char * rest = _input.get_available(comment_packet.offset() + 1, rest_size);
+                os.put_bytes(rest, rest_size);
+                if (rest_size != size-1U)
+                {
+                    throw Parse_error_str("file truncated");
+                }
             }
 
             // identification packet on its own page
@@ -1260,11 +1597,12 @@ void Wwise_RIFF_Vorbis::generate_ogg_header_with_triad(Bit_oggstream& os)
 
         // copy setup packet
         {
-            Packet_8 setup_packet(_infile, offset, _little_endian);
+            Packet_8 setup_packet(_input, offset, _little_endian);
 
-            _infile.seekg(setup_packet.offset());
             if (setup_packet.granule() != 0) throw Parse_error_str("setup packet granule != 0");
-            Bit_stream ss(_infile);
+            unsigned long setup_size = setup_packet.size();
+            const unsigned char * setup_data = _input.get_available(setup_packet.offset(), setup_size);
+            Bit_stream ss(setup_data, setup_size);
 
             Bit_uint<8> c;
             ss >> c;
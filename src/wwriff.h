@@ -5,16 +5,25 @@
 #define __STDC_CONSTANT_MACROS
 #endif
 #include <string>
+#include <vector>
 #include <iostream>
 #include <fstream>
 #include "Bit_stream.h"
+#include "input_buffer.h"
 #include "stdint.h"
 #include "errors.h"
+#include "stats.h"
 
 #define VERSION "0.24"
 
 using namespace std;
 
+class codebook_library;
+class Setup_cache;
+class Setup_header;
+class Packet_index;
+class Audio_chunks;
+
 enum ForcePacketFormat {
     kNoForcePacketFormat,
     kForceModPackets,
@@ -24,9 +33,10 @@ enum ForcePacketFormat {
 
 class Wwise_RIFF_Vorbis
 {
-    string _file_name;
     string _codebooks_name;
-    ifstream _infile;
+    const codebook_library * _codebooks;
+    Setup_cache * _setup_cache;
+    const Input_buffer& _input;
     long _file_size;
 
     bool _little_endian;
@@ -62,21 +72,51 @@ class Wwise_RIFF_Vorbis
     bool _header_triad_present, _old_packet_headers;
     bool _no_granule, _mod_packets;
 
-    uint16_t (*_read_16)(std::istream &is);
-    uint32_t (*_read_32)(std::istream &is);
+    uint16_t (*_read_16)(const unsigned char b[2]);
+    uint32_t (*_read_32)(const unsigned char b[4]);
+
+    Conversion_stats * _stats;
+
+    // Intentionally undefined
+    Wwise_RIFF_Vorbis& operator=(const Wwise_RIFF_Vorbis& rhs);
+    Wwise_RIFF_Vorbis(const Wwise_RIFF_Vorbis& rhs);
+
+    // fewer packets than this to a thread isn't worth it
+    enum {min_chunk_packets = 256};
+
+    long audio_packet_header_size(void) const;
+    void index_audio_packets(Packet_index& index, const vector<bool> * mode_blockflag, int mode_bits) const;
+    void write_audio_packets(Bit_oggstream& os, const Packet_index& index,
+            size_t begin, size_t end, bool have_mode_blockflag, int mode_bits, Conversion_stats * stats) const;
+    void write_audio_packets_parallel(Bit_oggstream& os, ostream& of, const Packet_index& index,
+            bool have_mode_blockflag, int mode_bits, unsigned int threads) const;
+
+    friend class Audio_chunks;
 public:
     Wwise_RIFF_Vorbis(
-      const string& name,
+      const Input_buffer& input,
       const string& _codebooks_name,
+      const codebook_library * codebooks,
+      Setup_cache * setup_cache,
+      Conversion_stats * stats,
       bool inline_codebooks,
       bool full_setup,
       ForcePacketFormat force_packet_format
       );
 
-    void print_info(void);
-
-    void generate_ogg(ofstream& of);
-    void generate_ogg_header(Bit_oggstream& os, bool * & mode_blockflag, int & mode_bits);
+    void print_info(ostream& os);
+
+    // page_size 0 for a page per audio packet, otherwise pack them into
+    // pages of about that many bytes; recompute_granules replaces the
+    // stored granules with ones counted from the block sizes (when the
+    // mode table is known, so not with the triad or --full-setup); with
+    // threads > 1 and a page per packet, long files are converted in
+    // chunks on that many threads, to the same output
+    void generate_ogg(ostream& of, unsigned int page_size = 0, bool recompute_granules = false,
+            unsigned int threads = 1);
+    void generate_ogg_header(Bit_oggstream& os, vector<bool>& mode_blockflag, int & mode_bits);
+    void rebuild_setup(const unsigned char * setup_data, unsigned long setup_size, unsigned long packet_size,
+                       const codebook_library * external_cbl, Setup_header& out);
     void generate_ogg_header_with_triad(Bit_oggstream& os);
 };
 